@@ -1,4 +1,3 @@
-#include <math.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -11,6 +10,7 @@
 // Header Files
 #include "code.h"
 #include "io.h"
+#include "lz78.h"
 #include "word.h"
 #include "trie.h"
 
@@ -40,10 +40,6 @@ void print_help(void) {
 }
 
 // Helper function for calculating bit length
-int bit_len(int bits) {
-    return (int) log2(bits) + 1;
-}
-
 int main(int argc, char **argv) {
     int opt = 0;
     int input = STDIN_FILENO; // Set input to STDIN file descriptor
@@ -89,21 +85,10 @@ int main(int argc, char **argv) {
 
     fchmod(output, out.protection); // Set permissions to same as the input file
 
-    // Lines 93-106 based on pseudocode from Prof. Darrell Long
-    WordTable *table = wt_create();
-    uint8_t curr_sym = 0;
-    uint16_t curr_code = 0;
-    int next_code = START_CODE;
-    while (read_pair(input, &curr_code, &curr_sym, bit_len(next_code)) == true) {
-        table[next_code] = word_append_sym(table[curr_code], curr_sym);
-        write_word(output, table[next_code]);
-        next_code = next_code + 1;
-        if (next_code == MAX_CODE) {
-            wt_reset(table);
-            next_code = START_CODE;
-        }
+    if (!lz78_decode(input, output)) {
+        fprintf(stderr, "Corrupt or truncated input!\n");
+        exit(1);
     }
-    flush_words(output);
 
     // Check if verbose output enabled
     if (v_flag == true) {
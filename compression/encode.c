@@ -1,4 +1,3 @@
-#include <math.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -11,6 +10,7 @@
 // Header Files
 #include "code.h"
 #include "io.h"
+#include "lz78.h"
 #include "word.h"
 #include "trie.h"
 
@@ -40,10 +40,6 @@ void print_help(void) {
 }
 
 // Helper function for calculating bit length
-int bit_len(int bits) {
-    return (int) log2(bits) + 1;
-}
-
 int main(int argc, char **argv) {
     int opt = 0;
     int input = STDIN_FILENO; // Set input to STDIN file descriptor
@@ -86,37 +82,7 @@ int main(int argc, char **argv) {
     fchmod(output, out.protection); // Set permissions to same as the input file
     write_header(output, &out); // Write the FileHeader to the beginning of output
 
-    // Lines 90-119 based on pseudocode from Prof. Darrell Long
-    TrieNode *root = trie_create();
-    TrieNode *curr_node = root;
-    TrieNode *prev_node = NULL;
-    uint8_t curr_sym = 0;
-    uint8_t prev_sym = 0;
-    int next_code = START_CODE;
-    while (read_sym(input, &curr_sym) == true) {
-        TrieNode *next_node = trie_step(curr_node, curr_sym);
-        if (next_node != NULL) {
-            prev_node = curr_node;
-            curr_node = next_node;
-        } else {
-            write_pair(output, curr_node->code, curr_sym, bit_len(next_code));
-            curr_node->children[curr_sym] = trie_node_create(next_code);
-            curr_node = root;
-            next_code = next_code + 1;
-        }
-        if (next_code == MAX_CODE) {
-            trie_reset(root);
-            curr_node = root;
-            next_code = START_CODE;
-        }
-        prev_sym = curr_sym;
-    }
-    if (curr_node != root) {
-        write_pair(output, prev_node->code, prev_sym, bit_len(next_code));
-        next_code = (next_code + 1) % MAX_CODE;
-    }
-    write_pair(output, STOP_CODE, 0, bit_len(next_code));
-    flush_pairs(output);
+    lz78_encode(input, output);
 
     // Check if verbose output enabled
     if (v_flag == true) {
@@ -18,8 +18,10 @@ static int pb_index = 0; // Index for pair_buffer
 
 static uint8_t buffer[BLOCK] = { 0 }; // Global buffer for read_pair write_pair.
 static int b_index = 0; // Index for buffer
+static int b_end = 0; // Bytes of buffer filled by read_pair
 
 static int n_1 = -1; // Represents EOF/-1
+static int sym_end = -1; // Index in read_sym's input where EOF is, once known
 
 uint8_t read_bit(uint8_t *buf, uint64_t bit) {
     // Calculate the index in buf that contains the bit
@@ -166,14 +168,17 @@ void write_header(int outfile, FileHeader *header) {
 // false.
 //
 bool read_sym(int infile, uint8_t *sym) {
-    if (pb_index == n_1) { // If buffer index is -1, EOF is reached
+    if (pb_index == sym_end) { // EOF is reached
         return false;
     }
 
     if (pb_index % BLOCK == 0) { // Check if buffer is empty and needs to be refilled
         int bytes_read = read_bytes(infile, pair_buffer, BLOCK);
         if (bytes_read < BLOCK) {
-            n_1 = pb_index + bytes_read; // Keeps track of the end of file
+            sym_end = pb_index + bytes_read; // Keeps track of the end of file
+        }
+        if (bytes_read == 0) { // Input was empty or ended on a block boundary
+            return false;
         }
     }
 
@@ -273,7 +278,11 @@ bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen) {
     *sym = 0;
     for (int i = 0; i < bitlen; i++) { // Loop through bitlen bits of code
         if (b_index == 0) { // Check if buffer is empty
-            read_bytes(infile, buffer, BLOCK); // Read bytes into the buffer
+            b_end = read_bytes(infile, buffer, BLOCK); // Read bytes into the buffer
+        }
+        if (b_index / 8 >= b_end) { // Input ended before STOP_CODE
+            *code = MAX_CODE;
+            return false;
         }
 
         *code |= write_bit(buffer, b_index) << i; // Set the i-th bit of code
@@ -283,7 +292,11 @@ bool read_pair(int infile, uint16_t *code, uint8_t *sym, int bitlen) {
 
     for (int i = 0; i < 8; i++) { // Loop through bits of sym
         if (b_index == 0) { // Check if buffer is empty
-            read_bytes(infile, buffer, BLOCK); // Read bytes into the buffer
+            b_end = read_bytes(infile, buffer, BLOCK); // Read bytes into the buffer
+        }
+        if (b_index / 8 >= b_end) { // Input ended before STOP_CODE
+            *code = MAX_CODE;
+            return false;
         }
 
         *sym |= write_bit(buffer, b_index) << i; // Set the i-th bit of sym
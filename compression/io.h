@@ -112,7 +112,8 @@ void flush_pairs(int outfile);
 
 //
 // Read bitlen bits of a code into *code, and then a full 8-bit symbol into *sym, from infile.
-// Return true if the complete pair was read and false otherwise.
+// Return true if the complete pair was read and false otherwise. If infile ends before the pair
+// does, *code is set to MAX_CODE, which is never written as a code.
 //
 // Like write_pair, this function must read the least significant bit of each input byte first, and
 // will store those bits into the LSB of *code and of *sym first.
@@ -0,0 +1,73 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "code.h"
+#include "io.h"
+#include "lz78.h"
+#include "trie.h"
+#include "word.h"
+
+int bit_len(int code) {
+    return (int) log2(code) + 1;
+}
+
+// Based on pseudocode from Prof. Darrell Long
+void lz78_encode(int infile, int outfile) {
+    TrieNode *root = trie_create();
+    TrieNode *curr_node = root;
+    TrieNode *prev_node = NULL;
+    uint8_t curr_sym = 0;
+    uint8_t prev_sym = 0;
+    int next_code = START_CODE;
+    while (read_sym(infile, &curr_sym) == true) {
+        TrieNode *next_node = trie_step(curr_node, curr_sym);
+        if (next_node != NULL) {
+            prev_node = curr_node;
+            curr_node = next_node;
+        } else {
+            write_pair(outfile, curr_node->code, curr_sym, bit_len(next_code));
+            curr_node->children[curr_sym] = trie_node_create(next_code);
+            curr_node = root;
+            next_code = next_code + 1;
+        }
+        if (next_code == MAX_CODE) {
+            trie_reset(root);
+            curr_node = root;
+            next_code = START_CODE;
+        }
+        prev_sym = curr_sym;
+    }
+    if (curr_node != root) {
+        write_pair(outfile, prev_node->code, prev_sym, bit_len(next_code));
+        next_code = (next_code + 1) % MAX_CODE;
+    }
+    write_pair(outfile, STOP_CODE, 0, bit_len(next_code));
+    flush_pairs(outfile);
+    trie_delete(root);
+}
+
+// Based on pseudocode from Prof. Darrell Long
+bool lz78_decode(int infile, int outfile) {
+    WordTable *table = wt_create();
+    uint8_t curr_sym = 0;
+    uint16_t curr_code = 0;
+    int next_code = START_CODE;
+    bool ok = true;
+    while (read_pair(infile, &curr_code, &curr_sym, bit_len(next_code)) == true) {
+        if (curr_code >= next_code) {
+            ok = false; // corrupt input
+            break;
+        }
+        table[next_code] = word_append_sym(table[curr_code], curr_sym);
+        write_word(outfile, table[next_code]);
+        next_code = next_code + 1;
+        if (next_code == MAX_CODE) {
+            wt_reset(table);
+            next_code = START_CODE;
+        }
+    }
+    flush_words(outfile);
+    return ok && curr_code == STOP_CODE;
+}
@@ -0,0 +1,28 @@
+#ifndef __LZ78_H__
+#define __LZ78_H__
+
+#include <stdbool.h>
+
+//
+// Returns the number of bits needed to write code (log2(code) + 1).
+//
+int bit_len(int code);
+
+//
+// Compress everything read from infile into outfile as LZ78 pairs, ending with STOP_CODE.
+// Writes no FileHeader; encode writes one before calling this.
+//
+// The io module keeps its buffers in globals, so a process can only encode one stream.
+//
+void lz78_encode(int infile, int outfile);
+
+//
+// Decompress LZ78 pairs from infile into outfile until STOP_CODE. Expects no FileHeader;
+// decode reads one before calling this.
+//
+// Returns false if the input ended early or referenced a code that was never defined.
+// The io module keeps its buffers in globals, so a process can only decode one stream.
+//
+bool lz78_decode(int infile, int outfile);
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// header files
+#include "numtheory.h"
+#include "pool.h"
+#include "randstate.h"
+#include "ss.h"
+
+#define OPTIONS "hs:b:B:t:m:" //these are our argument options
+
+#define MIN_SAMPLES 3 // every timed section runs at least this many times
+#define MAX_SAMPLES 200 // and at most this many, however fast it is
+
+void print_help(void) { // helper function for printing help
+    fprintf(stderr,
+
+        "SYNOPSIS\n"
+        "   Benchmarks the number theory and SS routines and prints the results as JSON.\n"
+        "\n"
+        "USAGE\n"
+        "   ./benchmark [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -s seed         Random seed; every key size reseeds from it (default: 2024).\n"
+        "   -b bits         Smallest modulus size (default: 256).\n"
+        "   -B bits         Largest modulus size, sizes double from -b (default: 4096).\n"
+        "   -t ms           Time budget per measurement (default: 250).\n"
+        "   -m bytes        Plaintext size for the file encryption runs (default: 16384).\n");
+
+    return;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// True while a section that started at start should keep sampling.
+static bool more(double start, uint64_t done, double budget) {
+    return done < MIN_SAMPLES || (done < MAX_SAMPLES && now() - start < budget);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Random odd bits-bit number with the top bit set.
+static void random_odd(mpz_t o, uint64_t bits) {
+    mpz_urandomb(o, state, bits);
+    mpz_setbit(o, bits - 1);
+    mpz_setbit(o, 0);
+}
+
+static void bench_pow_mod(uint64_t bits, double budget) {
+    mpz_t n, a, d, o, ref;
+    mpz_inits(n, a, d, o, ref, NULL);
+    random_odd(n, bits);
+    mpz_urandomm(a, state, n);
+    mpz_urandomb(d, state, bits);
+
+    uint64_t ops = 0;
+    double start = now();
+    for (; more(start, ops, budget); ops++) {
+        pow_mod(o, a, d, n);
+    }
+    double ours = ops / (now() - start);
+
+    uint64_t ref_ops = 0;
+    start = now();
+    for (; more(start, ref_ops, budget); ref_ops++) {
+        mpz_powm(ref, a, d, n);
+    }
+    double theirs = ref_ops / (now() - start);
+
+    printf("      \"pow_mod\": {\"ops_per_s\": %.1f, \"mpz_powm_ops_per_s\": %.1f, "
+           "\"ratio\": %.3f, \"match\": %s},\n",
+        ours, theirs, ours / theirs, mpz_cmp(o, ref) == 0 ? "true" : "false");
+    mpz_clears(n, a, d, o, ref, NULL);
+}
+
+static void bench_is_prime(uint64_t bits, uint64_t iters, double budget) {
+    mpz_t n;
+    mpz_init(n);
+
+    // random odd candidates, nearly all composite and rejected by the first round
+    uint64_t composites = 0;
+    double spent = 0;
+    for (double start = now(); more(start, composites, budget); composites++) {
+        random_odd(n, bits);
+        double t = now();
+        is_prime(n, iters);
+        spent += now() - t;
+    }
+    double composite_us = 1e6 * spent / composites;
+
+    // a prime runs every round
+    make_prime(n, bits, iters);
+    uint64_t primes = 0;
+    double start = now();
+    for (; more(start, primes, budget); primes++) {
+        is_prime(n, iters);
+    }
+    double prime_us = 1e6 * (now() - start) / primes;
+
+    printf("      \"is_prime\": {\"composite_us\": %.2f, \"prime_us\": %.2f},\n", composite_us,
+        prime_us);
+    mpz_clear(n);
+}
+
+static void bench_make_prime(uint64_t bits, uint64_t iters, double budget) {
+    NTWorkspace w;
+    nt_workspace_init(&w, bits);
+    mpz_t p;
+    mpz_init(p);
+
+    uint64_t primes = 0;
+    double start = now();
+    for (; more(start, primes, budget); primes++) {
+        make_prime_ws(&w, p, bits, iters, state);
+    }
+    double spent = now() - start;
+
+    printf("      \"make_prime\": {\"bits\": %" PRIu64 ", \"primes\": %" PRIu64 ", "
+           "\"attempts_per_prime\": %.1f, \"ms_per_prime\": %.3f},\n",
+        bits, primes, (double) w.candidates / primes, 1e3 * spent / primes);
+    mpz_clear(p);
+    nt_workspace_clear(&w);
+}
+
+//
+// Compares the primality tests keygen -m offers on prime-sized numbers of a bits-bit key: a
+// random odd composite, a prime, and a whole make_prime_ws() search. mr is the default -i 50.
+//
+static void bench_prime_tests(uint64_t bits, uint64_t iters, double budget) {
+    static const struct {
+        const char *name;
+        PrimeTest test;
+    } modes[] = { { "mr", PRIME_MR }, { "sized", PRIME_MR_SIZED }, { "bpsw", PRIME_BPSW } };
+    uint64_t pbits = pool_bits(bits);
+    NTWorkspace w;
+    nt_workspace_init(&w, pbits);
+    mpz_t n, prime;
+    mpz_inits(n, prime, NULL);
+    make_prime(prime, pbits, iters);
+
+    printf("      \"prime_tests\": {\"bits\": %" PRIu64, pbits);
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        w.test = modes[m].test;
+
+        uint64_t composites = 0;
+        double spent = 0;
+        for (double start = now(); more(start, composites, budget); composites++) {
+            random_odd(n, pbits);
+            double t = now();
+            is_prime_ws(&w, n, iters, state);
+            spent += now() - t;
+        }
+        double composite_us = 1e6 * spent / composites;
+
+        // a prime found by make_prime_ws() gets the sized round count, any other input iters
+        uint64_t rounds = modes[m].test == PRIME_MR_SIZED ? mr_rounds_for_bits(pbits) : iters;
+        uint64_t primes = 0;
+        double start = now();
+        for (; more(start, primes, budget); primes++) {
+            is_prime_ws(&w, prime, rounds, state);
+        }
+        double prime_us = 1e6 * (now() - start) / primes;
+
+        uint64_t made = 0;
+        start = now();
+        for (; more(start, made, budget); made++) {
+            make_prime_ws(&w, n, pbits, iters, state);
+        }
+        double make_ms = 1e3 * (now() - start) / made;
+
+        printf(", \"%s\": {\"composite_us\": %.2f, \"prime_us\": %.2f, "
+               "\"make_prime_ms\": %.3f}",
+            modes[m].name, composite_us, prime_us, make_ms);
+    }
+    printf("},\n");
+    mpz_clears(n, prime, NULL);
+    nt_workspace_clear(&w);
+}
+
+static void bench_make_pub(uint64_t bits, uint64_t iters, double budget) {
+    mpz_t p, q, n;
+    mpz_inits(p, q, n, NULL);
+
+    double ms[MAX_SAMPLES], total = 0;
+    uint64_t samples = 0;
+    for (double start = now(); more(start, samples, budget); samples++) {
+        double t = now();
+        ss_make_pub(p, q, n, bits, iters);
+        ms[samples] = 1e3 * (now() - t);
+        total += ms[samples];
+    }
+    qsort(ms, samples, sizeof(double), cmp_double);
+
+    printf("      \"ss_make_pub\": {\"samples\": %" PRIu64 ", \"min_ms\": %.3f, "
+           "\"median_ms\": %.3f, \"p90_ms\": %.3f, \"max_ms\": %.3f, \"mean_ms\": %.3f},\n",
+        samples, ms[0], ms[samples / 2], ms[(samples * 9) / 10], ms[samples - 1],
+        total / samples);
+    mpz_clears(p, q, n, NULL);
+}
+
+// Times one pass of ss_encrypt_file and ss_decrypt_file over len random bytes.
+static void bench_files(uint64_t bits, uint64_t iters, size_t len) {
+    mpz_t p, q, n, d, pq;
+    mpz_inits(p, q, n, d, pq, NULL);
+    ss_make_pub(p, q, n, bits, iters);
+    ss_make_priv(d, pq, p, q);
+
+    FILE *plain = tmpfile(), *cipher = tmpfile(), *back = tmpfile();
+    if (plain == NULL || cipher == NULL || back == NULL) {
+        perror("Error creating temporary file");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < len; i++) {
+        fputc((int) gmp_urandomb_ui(state, 8), plain);
+    }
+    rewind(plain);
+
+    double t = now();
+    ss_encrypt_file(plain, cipher, n);
+    fflush(cipher);
+    double enc = now() - t;
+
+    rewind(cipher);
+    t = now();
+    ss_decrypt_file(cipher, back, d, pq);
+    fflush(back);
+    double dec = now() - t;
+
+    bool match = ftell(back) == (long) len;
+    rewind(plain);
+    rewind(back);
+    for (size_t i = 0; match && i < len; i++) {
+        match = fgetc(plain) == fgetc(back);
+    }
+
+    printf("      \"ss_file\": {\"bytes\": %zu, \"encrypt_mb_s\": %.4f, \"decrypt_mb_s\": %.4f, "
+           "\"match\": %s}\n",
+        len, len / enc / 1e6, len / dec / 1e6, match ? "true" : "false");
+    fclose(plain);
+    fclose(cipher);
+    fclose(back);
+    mpz_clears(p, q, n, d, pq, NULL);
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    uint64_t seed = 2024;
+    uint64_t min_bits = 256, max_bits = 4096;
+    uint64_t budget_ms = 250;
+    size_t file_bytes = 16384;
+    uint64_t iters = 50; // keygen's default
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
+        switch (opt) {
+        case 'h': print_help(); return 0;
+        case 's': seed = strtoul(optarg, NULL, 10); break;
+        case 'b': min_bits = strtoul(optarg, NULL, 10); break;
+        case 'B': max_bits = strtoul(optarg, NULL, 10); break;
+        case 't': budget_ms = strtoul(optarg, NULL, 10); break;
+        case 'm': file_bytes = strtoul(optarg, NULL, 10); break;
+        default:
+            print_help();
+            return 1;
+            break;
+        }
+    }
+    if (min_bits < 16 || max_bits < min_bits) {
+        print_help();
+        return 1;
+    }
+    double budget = budget_ms / 1e3;
+
+    printf("{\n  \"seed\": %" PRIu64 ",\n  \"iters\": %" PRIu64 ",\n  \"budget_ms\": %" PRIu64
+           ",\n  \"sizes\": [\n",
+        seed, iters, budget_ms);
+    for (uint64_t bits = min_bits; bits <= max_bits; bits *= 2) {
+        // same inputs for a size no matter which sizes ran before it
+        randstate_init(derive_seed(seed, bits));
+        srandom(derive_seed(seed, bits)); // ss_make_pub draws the prime size from random()
+
+        printf("    {\n      \"bits\": %" PRIu64 ",\n", bits);
+        bench_pow_mod(bits, budget);
+        bench_is_prime(bits, iters, budget);
+        bench_make_prime(pool_bits(bits), iters, budget); // prime size of a bits-bit key
+        bench_prime_tests(bits, iters, budget);
+        bench_make_pub(bits, iters, budget);
+        bench_files(bits, iters, file_bytes);
+        printf("    }%s\n", bits * 2 <= max_bits ? "," : "");
+        fflush(stdout);
+
+        randstate_clear();
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
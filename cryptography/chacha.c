@@ -0,0 +1,282 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "chacha.h"
+
+static uint32_t load32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16)
+           | ((uint32_t) p[3] << 24);
+}
+
+static void store32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static void store64(uint8_t *p, uint64_t v) {
+    store32(p, (uint32_t) v);
+    store32(p + 4, (uint32_t) (v >> 32));
+}
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d)                                                                  \
+    a += b;                                                                                        \
+    d ^= a;                                                                                        \
+    d = ROTL(d, 16);                                                                               \
+    c += d;                                                                                        \
+    b ^= c;                                                                                        \
+    b = ROTL(b, 12);                                                                               \
+    a += b;                                                                                        \
+    d ^= a;                                                                                        \
+    d = ROTL(d, 8);                                                                                \
+    c += d;                                                                                        \
+    b ^= c;                                                                                        \
+    b = ROTL(b, 7);
+
+// Produces one 64-byte keystream block for the given state words.
+static void chacha20_block(uint8_t out[64], const uint32_t in[16]) {
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+    for (int i = 0; i < 10; i++) { // 20 rounds, two per iteration
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        store32(out + 4 * i, x[i] + in[i]);
+    }
+}
+
+void chacha20_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t key[AEAD_KEY_BYTES],
+    const uint8_t nonce[AEAD_NONCE_BYTES], uint32_t counter) {
+    uint32_t state[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 }; // "expand 32-byte k"
+    for (int i = 0; i < 8; i++) {
+        state[4 + i] = load32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; i++) {
+        state[13 + i] = load32(nonce + 4 * i);
+    }
+
+    uint8_t block[64];
+    while (len > 0) {
+        chacha20_block(block, state);
+        size_t n = len < 64 ? len : 64;
+        for (size_t i = 0; i < n; i++) {
+            out[i] = in[i] ^ block[i];
+        }
+        state[12] += 1;
+        out += n;
+        in += n;
+        len -= n;
+    }
+}
+
+//
+// Poly1305 with five 26-bit limbs, so every product fits in 64 bits.
+//
+typedef struct Poly1305 {
+    uint32_t r[5], h[5], pad[4];
+} Poly1305;
+
+static void poly1305_init(Poly1305 *st, const uint8_t key[32]) {
+    // r is clamped as the spec requires
+    st->r[0] = (load32(key + 0)) & 0x3ffffff;
+    st->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    st->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    st->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    st->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    memset(st->h, 0, sizeof(st->h));
+    for (int i = 0; i < 4; i++) {
+        st->pad[i] = load32(key + 16 + 4 * i);
+    }
+}
+
+// Absorbs 16-byte blocks; hibit is 1 << 24 for full blocks and 0 for the padded last block.
+static void poly1305_blocks(Poly1305 *st, const uint8_t *m, size_t len, uint32_t hibit) {
+    uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], r3 = st->r[3], r4 = st->r[4];
+    uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+
+    while (len >= 16) {
+        h0 += (load32(m + 0)) & 0x3ffffff;
+        h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+        h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+        h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+        h4 += (load32(m + 12) >> 8) | hibit;
+
+        uint64_t d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3
+                      + (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+        uint64_t d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4
+                      + (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+        uint64_t d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0
+                      + (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+        uint64_t d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1
+                      + (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+        uint64_t d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2
+                      + (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+        // partial reduction mod 2^130 - 5
+        uint32_t c = (uint32_t) (d0 >> 26);
+        h0 = (uint32_t) d0 & 0x3ffffff;
+        d1 += c;
+        c = (uint32_t) (d1 >> 26);
+        h1 = (uint32_t) d1 & 0x3ffffff;
+        d2 += c;
+        c = (uint32_t) (d2 >> 26);
+        h2 = (uint32_t) d2 & 0x3ffffff;
+        d3 += c;
+        c = (uint32_t) (d3 >> 26);
+        h3 = (uint32_t) d3 & 0x3ffffff;
+        d4 += c;
+        c = (uint32_t) (d4 >> 26);
+        h4 = (uint32_t) d4 & 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= 0x3ffffff;
+        h1 += c;
+
+        m += 16;
+        len -= 16;
+    }
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+    st->h[3] = h3;
+    st->h[4] = h4;
+}
+
+// Absorbs any length; a trailing partial block is padded with 0x01 then zeros.
+static void poly1305_update(Poly1305 *st, const uint8_t *m, size_t len) {
+    size_t full = len & ~(size_t) 15;
+    poly1305_blocks(st, m, full, 1 << 24);
+    if (len > full) {
+        uint8_t last[16] = { 0 };
+        memcpy(last, m + full, len - full);
+        last[len - full] = 1;
+        poly1305_blocks(st, last, 16, 0);
+    }
+}
+
+static void poly1305_finish(Poly1305 *st, uint8_t tag[AEAD_TAG_BYTES]) {
+    uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+
+    // full carry
+    uint32_t c = h1 >> 26;
+    h1 &= 0x3ffffff;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= 0x3ffffff;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= 0x3ffffff;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= 0x3ffffff;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= 0x3ffffff;
+    h1 += c;
+
+    // g = h + 5 - 2^130, pick g if it did not go negative
+    uint32_t g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1 << 26);
+
+    uint32_t mask = (g4 >> 31) - 1; // all ones if g >= 0
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // h = h mod 2^128, then add pad
+    uint64_t f;
+    f = (uint64_t) (h0 | (h1 << 26)) + st->pad[0];
+    store32(tag + 0, (uint32_t) f);
+    f = (uint64_t) ((h1 >> 6) | (h2 << 20)) + st->pad[1] + (f >> 32);
+    store32(tag + 4, (uint32_t) f);
+    f = (uint64_t) ((h2 >> 12) | (h3 << 14)) + st->pad[2] + (f >> 32);
+    store32(tag + 8, (uint32_t) f);
+    f = (uint64_t) ((h3 >> 18) | (h4 << 8)) + st->pad[3] + (f >> 32);
+    store32(tag + 12, (uint32_t) f);
+}
+
+void poly1305(uint8_t tag[AEAD_TAG_BYTES], const uint8_t *msg, size_t len, const uint8_t key[32]) {
+    Poly1305 st;
+    poly1305_init(&st, key);
+    poly1305_update(&st, msg, len);
+    poly1305_finish(&st, tag);
+}
+
+// Absorbs data zero-padded to a multiple of 16 bytes, as the AEAD construction requires.
+static void poly1305_pad16(Poly1305 *st, const uint8_t *m, size_t len) {
+    size_t full = len & ~(size_t) 15;
+    poly1305_blocks(st, m, full, 1 << 24);
+    if (len > full) {
+        uint8_t last[16] = { 0 };
+        memcpy(last, m + full, len - full);
+        poly1305_blocks(st, last, 16, 1 << 24);
+    }
+}
+
+// Tag over aad and ciphertext as laid out in RFC 8439, section 2.8.
+static void aead_tag(uint8_t tag[AEAD_TAG_BYTES], const uint8_t *ct, size_t len,
+    const uint8_t *aad, size_t aad_len, const uint8_t key[AEAD_KEY_BYTES],
+    const uint8_t nonce[AEAD_NONCE_BYTES]) {
+    uint8_t otk[64] = { 0 };
+    chacha20_xor(otk, otk, sizeof(otk), key, nonce, 0); // one-time key from block 0
+
+    Poly1305 st;
+    poly1305_init(&st, otk);
+    poly1305_pad16(&st, aad, aad_len);
+    poly1305_pad16(&st, ct, len);
+    uint8_t lengths[16];
+    store64(lengths, aad_len);
+    store64(lengths + 8, len);
+    poly1305_blocks(&st, lengths, 16, 1 << 24);
+    poly1305_finish(&st, tag);
+}
+
+void aead_encrypt(uint8_t *out, uint8_t tag[AEAD_TAG_BYTES], const uint8_t *in, size_t len,
+    const uint8_t *aad, size_t aad_len, const uint8_t key[AEAD_KEY_BYTES],
+    const uint8_t nonce[AEAD_NONCE_BYTES]) {
+    chacha20_xor(out, in, len, key, nonce, 1);
+    aead_tag(tag, out, len, aad, aad_len, key, nonce);
+}
+
+bool aead_decrypt(uint8_t *out, const uint8_t *in, size_t len, const uint8_t tag[AEAD_TAG_BYTES],
+    const uint8_t *aad, size_t aad_len, const uint8_t key[AEAD_KEY_BYTES],
+    const uint8_t nonce[AEAD_NONCE_BYTES]) {
+    uint8_t expected[AEAD_TAG_BYTES];
+    aead_tag(expected, in, len, aad, aad_len, key, nonce);
+
+    uint8_t diff = 0; // constant-time compare
+    for (int i = 0; i < AEAD_TAG_BYTES; i++) {
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        return false;
+    }
+    chacha20_xor(out, in, len, key, nonce, 1);
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AEAD_KEY_BYTES   32
+#define AEAD_NONCE_BYTES 12
+#define AEAD_TAG_BYTES   16
+
+//
+// XORs len bytes of the ChaCha20 keystream (RFC 8439) into out.
+//
+// Requires:
+//  out: len bytes, may be the same buffer as in
+//  in: len bytes of input
+//  key: 32-byte key
+//  nonce: 12-byte nonce
+//  counter: block counter of the first keystream block
+//
+void chacha20_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t key[AEAD_KEY_BYTES],
+    const uint8_t nonce[AEAD_NONCE_BYTES], uint32_t counter);
+
+//
+// Computes the Poly1305 one-time authenticator of msg under a 32-byte one-time key.
+//
+void poly1305(uint8_t tag[AEAD_TAG_BYTES], const uint8_t *msg, size_t len, const uint8_t key[32]);
+
+//
+// ChaCha20-Poly1305 authenticated encryption (RFC 8439, section 2.8).
+//
+// Provides:
+//  out: len bytes of ciphertext (may be the same buffer as in)
+//  tag: 16-byte authentication tag over aad and the ciphertext
+//
+// Requires:
+//  a key/nonce pair that is never used for two different messages
+//
+void aead_encrypt(uint8_t *out, uint8_t tag[AEAD_TAG_BYTES], const uint8_t *in, size_t len,
+    const uint8_t *aad, size_t aad_len, const uint8_t key[AEAD_KEY_BYTES],
+    const uint8_t nonce[AEAD_NONCE_BYTES]);
+
+//
+// ChaCha20-Poly1305 authenticated decryption (RFC 8439, section 2.8).
+//
+// Returns false, leaving out untouched, if the tag does not match. Otherwise writes len bytes of
+// plaintext to out (may be the same buffer as in) and returns true.
+//
+bool aead_decrypt(uint8_t *out, const uint8_t *in, size_t len, const uint8_t tag[AEAD_TAG_BYTES],
+    const uint8_t *aad, size_t aad_len, const uint8_t key[AEAD_KEY_BYTES],
+    const uint8_t nonce[AEAD_NONCE_BYTES]);
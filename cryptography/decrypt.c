@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
@@ -10,8 +11,9 @@
 #include "numtheory.h"
 #include "randstate.h"
 #include "ss.h"
+#include "stats.h"
 
-#define OPTIONS "hvi:o:n:" //these are our argument options
+#define OPTIONS "hvi:o:n:x:r:" //these are our argument options
 
 //here we initialize all flag booleans
 bool v_flag = false;
@@ -30,10 +32,15 @@ void print_help(void) { // helper function for printing help
         "\n"
         "OPTIONS\n"
         "   -h              Display program help and usage.\n"
-        "   -v              Display verbose program output.\n"
+        "   -v              Display verbose program output and a JSON stats summary.\n"
         "   -i infile       Input file of data to decrypt (default: stdin).\n"
         "   -o outfile      Output file for decrypted data (default: stdout).\n"
-        "   -n pvfile       Private key file (default: ss.priv).\n");
+        "                   Hybrid (encrypt -H) and compressed (encrypt -z) input\n"
+        "                   are detected automatically.\n"
+        "   -n pvfile       Private key file (default: ss.priv).\n"
+        "   -x index        Index written by encrypt -x for the input.\n"
+        "   -r start:len    With -x and -i, decrypt only plaintext bytes [start, start + len),\n"
+        "                   touching only those blocks.\n");
 
     return;
 }
@@ -55,6 +62,9 @@ int main(int argc, char **argv) {
     FILE *input = stdin;
     FILE *output = stdout;
     char *pvfile = "ss.priv";
+    FILE *index = NULL;
+    bool r_flag = false;
+    uint64_t start = 0, len = 0;
 
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
         switch (opt) {
@@ -79,12 +89,32 @@ int main(int argc, char **argv) {
             }
             break;
         case 'n': pvfile = optarg; break;
+        case 'x':
+            index = fopen(optarg, "r");
+            if (index == NULL) {
+                perror("Error opening index file");
+                return 1;
+            }
+            break;
+        case 'r':
+            r_flag = true;
+            // both fields are required, and the range must not wrap past the end of uint64_t
+            if (sscanf(optarg, "%" SCNu64 ":%" SCNu64, &start, &len) != 2
+                || len > UINT64_MAX - start) {
+                print_help();
+                return 1;
+            }
+            break;
         default:
             print_help();
             return 1;
             break;
         }
     }
+    if (r_flag != (index != NULL)) {
+        fprintf(stderr, "-r and -x must be given together.\n");
+        return 1;
+    }
 
     mpz_t pq, d;
     mpz_inits(pq, d, NULL);
@@ -100,7 +130,43 @@ int main(int argc, char **argv) {
         gmp_printf("pq  (%d bits) = %Zd\n", mpz_sizeinbase(pq, 2), pq);
         gmp_printf("d  (%d bits) = %Zd\n", mpz_sizeinbase(d, 2), d);
     }
-    ss_decrypt_file(input, output, d, pq);
+    // a range of indexed input skips every block outside it
+    if (r_flag == true) {
+        SSKeyCtx *ctx = ss_decrypt_ctx_create(d, pq);
+        bool ok = ctx != NULL && ss_decrypt_range(input, index, output, ctx, start, len);
+        ss_ctx_delete(ctx);
+        if (!ok) {
+            fprintf(stderr, "Range decryption failed: index does not match the input or key.\n");
+            return 1;
+        }
+        fclose(index);
+    } else {
+        // compressed input is decrypted into the LZ78 decoder instead of straight to output
+        SSLz78 lz;
+        FILE *plain = output;
+        bool z_flag = ss_is_compressed(input);
+        if (z_flag == true) {
+            plain = ss_lz78_decompress(output, &lz);
+        }
+
+        if (ss_is_hybrid(input)) {
+            SSKeyCtx *ctx = ss_decrypt_ctx_create(d, pq);
+            bool ok = ctx != NULL && ss_decrypt_file_hybrid(input, plain, ctx);
+            ss_ctx_delete(ctx);
+            if (!ok) {
+                fprintf(stderr, "Hybrid decryption failed: bad key or corrupted input.\n");
+                return 1;
+            }
+        } else if (!ss_decrypt_file(input, plain, d, pq)) {
+            fprintf(stderr, "Decryption failed: bad key or corrupted input.\n");
+            return 1;
+        }
+
+        if (z_flag == true && !ss_lz78_finish(&lz)) {
+            fprintf(stderr, "Decompression failed: corrupted input.\n");
+            return 1;
+        }
+    }
     fclose(priv_file);
 
     if (i_flag == true) {
@@ -113,6 +179,10 @@ int main(int argc, char **argv) {
 
     mpz_clears(pq, d, NULL);
 
+    if (v_flag == true) {
+        stats_report(stderr); // counters are only filled in with make STATS=1
+    }
+
     // Close the files
 
     return 0;
@@ -10,13 +10,16 @@
 #include "numtheory.h"
 #include "randstate.h"
 #include "ss.h"
+#include "stats.h"
 
-#define OPTIONS "hvi:o:n:" //these are our argument options
+#define OPTIONS "hvHzi:o:n:x:" //these are our argument options
 
 //here we initialize all flag booleans
 bool v_flag = false;
 bool i_flag = false;
 bool o_flag = false;
+bool H_flag = false;
+bool z_flag = false;
 
 void print_help(void) { // helper function for printing help
     fprintf(stderr,
@@ -30,10 +33,14 @@ void print_help(void) { // helper function for printing help
         "\n"
         "OPTIONS\n"
         "   -h              Display program help and usage.\n"
-        "   -v              Display verbose program output.\n"
+        "   -v              Display verbose program output and a JSON stats summary.\n"
+        "   -H              Hybrid mode: SS-encrypt a session key, ChaCha20-Poly1305 the data.\n"
+        "   -z              Compress the data with LZ78 before encrypting it.\n"
         "   -i infile       Input file of data to encrypt (default: stdin).\n"
         "   -o outfile      Output file for encrypted data (default: stdout).\n"
-        "   -n pbfile       Public key file (default: ss.pub).\n");
+        "   -n pbfile       Public key file (default: ss.pub).\n"
+        "   -x index        Also write a block index so decrypt -r can decrypt any byte range\n"
+        "                   without the blocks before it. Not with -H or -z.\n");
 
     return;
 }
@@ -55,6 +62,7 @@ int main(int argc, char **argv) {
     FILE *input = stdin;
     FILE *output = stdout;
     char *pbfile = "ss.pub";
+    FILE *index = NULL;
 
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
         switch (opt) {
@@ -62,6 +70,12 @@ int main(int argc, char **argv) {
         case 'v':
             change_v_flag(&v_flag); //flag is flipped if argument is given
             break;
+        case 'H':
+            H_flag = true;
+            break;
+        case 'z':
+            z_flag = true;
+            break;
         case 'i':
             change_i_flag(&i_flag);
             input = fopen(optarg, "r");
@@ -79,12 +93,23 @@ int main(int argc, char **argv) {
             }
             break;
         case 'n': pbfile = optarg; break;
+        case 'x':
+            index = fopen(optarg, "w");
+            if (index == NULL) {
+                perror("Error opening index file");
+                return 1;
+            }
+            break;
         default:
             print_help();
             return 1;
             break;
         }
     }
+    if (index != NULL && (H_flag == true || z_flag == true)) {
+        fprintf(stderr, "An index can only be written for plain SS encryption.\n");
+        return 1;
+    }
 
     mpz_t n;
     mpz_init(n);
@@ -107,7 +132,38 @@ int main(int argc, char **argv) {
         gmp_printf("n  (%d bits) = %Zd\n", mpz_sizeinbase(n, 2), n);
     }
 
-    ss_encrypt_file(input, output, n);
+    // with -z, encrypt the compressed stream instead of the input itself
+    SSLz78 lz;
+    FILE *plain = input;
+    if (z_flag == true) {
+        fprintf(output, "%s\n", SS_LZ78_MAGIC);
+        plain = ss_lz78_compress(input, &lz);
+    }
+
+    if (H_flag == true) {
+        SSKeyCtx *ctx = ss_encrypt_ctx_create(n);
+        bool ok = ctx != NULL && ss_encrypt_file_hybrid(plain, output, ctx);
+        ss_ctx_delete(ctx);
+        if (!ok) {
+            fprintf(stderr, "Hybrid encryption failed (key too small or no randomness).\n");
+            return 1;
+        }
+    } else if (index != NULL) {
+        SSKeyCtx *ctx = ss_encrypt_ctx_create(n);
+        bool ok = ctx != NULL && ss_encrypt_file_indexed(plain, output, index, ctx);
+        ss_ctx_delete(ctx);
+        if (!ok) {
+            perror("Error writing index file");
+            return 1;
+        }
+        fclose(index);
+    } else {
+        ss_encrypt_file(plain, output, n);
+    }
+
+    if (z_flag == true) {
+        ss_lz78_finish(&lz);
+    }
 
     fclose(pub_file);
 
@@ -122,6 +178,10 @@ int main(int argc, char **argv) {
     mpz_clear(n);
     free(username);
 
+    if (v_flag == true) {
+        stats_report(stderr); // counters are only filled in with make STATS=1
+    }
+
     // Close the files
 
     return 0;
@@ -2,7 +2,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -11,8 +13,11 @@
 #include "numtheory.h"
 #include "randstate.h"
 #include "ss.h"
+#include "stats.h"
+#include "pool.h"
+#include "keystore.h"
 
-#define OPTIONS "hvb:i:n:d:s:" //these are our argument options
+#define OPTIONS "hvb:i:n:d:s:t:m:P:F:K:N:w:" //these are our argument options
 
 //here we initialize all flag booleans
 bool v_flag = false;
@@ -28,12 +33,22 @@ void print_help(void) { // helper function for printing help
         "\n"
         "OPTIONS\n"
         "-h              Display program help and usage.\n"
-        "-v              Display verbose program output.\n"
+        "-v              Display verbose program output and a JSON stats summary.\n"
         "-b bits         Minimum bits needed for public key n (default: 256).\n"
         "-i iterations   Miller-Rabin iterations for testing primes (default: 50).\n"
         "-n pbfile       Public key file (default: ss.pub).\n"
         "-d pvfile       Private key file (default: ss.priv).\n"
-        "-s seed         Random seed for testing.\n");
+        "-s seed         Random seed for testing.\n"
+        "-t threads      Worker threads per prime, p and q searched in parallel (default: 1).\n"
+        "-m mode         Primality test: mr (-i rounds), sized (rounds by bit size),\n"
+        "                bpsw (Baillie-PSW) (default: mr).\n"
+        "-P pooldir      Draw p and q from a prime pool, searching only if it is empty.\n"
+        "-F count        With -P, add count primes for -b bit keys to the pool and exit\n"
+        "                (seeded from the kernel, -s does not apply).\n"
+        "-K keystore     Batch mode: write -N key pairs and an index to this directory\n"
+        "                instead of -n/-d, and report keys/s.\n"
+        "-N count        Key pairs to generate in batch mode (default: 1).\n"
+        "-w workers      Batch mode worker threads, one key each at a time (default: 1).\n");
 
     return;
 }
@@ -44,10 +59,17 @@ void change_v_flag(bool *v_flag) { //these are the flag-flipper funcions
 
 int main(int argc, char **argv) {
     int opt = 0;
-    char *pbfile = "ss.pub", *pvfile = "ss.priv", *pnbits = NULL, *piters = NULL, *pseed = NULL;
+    char *pbfile = "ss.pub", *pvfile = "ss.priv", *pnbits = NULL, *piters = NULL, *pseed = NULL,
+         *pthreads = NULL, *pooldir = NULL;
     uint64_t nbits = 256;
     uint64_t iters = 50;
     uint64_t seed = time(NULL);
+    uint32_t threads = 1;
+    uint64_t fill = 0;
+    char *keystore = NULL;
+    uint64_t batch = 1;
+    uint32_t workers = 1;
+    PrimeTest test = PRIME_MR;
 
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
         switch (opt) {
@@ -69,6 +91,27 @@ int main(int argc, char **argv) {
             pseed = optarg;
             seed = strtoul(pseed, NULL, 10);
             break;
+        case 't':
+            pthreads = optarg;
+            threads = strtoul(pthreads, NULL, 10);
+            break;
+        case 'm':
+            if (strcmp(optarg, "mr") == 0) {
+                test = PRIME_MR;
+            } else if (strcmp(optarg, "sized") == 0) {
+                test = PRIME_MR_SIZED;
+            } else if (strcmp(optarg, "bpsw") == 0) {
+                test = PRIME_BPSW;
+            } else {
+                print_help();
+                return 1;
+            }
+            break;
+        case 'P': pooldir = optarg; break;
+        case 'F': fill = strtoul(optarg, NULL, 10); break;
+        case 'K': keystore = optarg; break;
+        case 'N': batch = strtoul(optarg, NULL, 10); break;
+        case 'w': workers = strtoul(optarg, NULL, 10); break;
         default:
             print_help();
             return 1;
@@ -76,6 +119,53 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (fill > 0) {
+        // fill mode only feeds the pool, it does not touch the key files
+        if (pooldir == NULL) {
+            print_help();
+            return 1;
+        }
+        uint64_t added = pool_fill(pooldir, pool_bits(nbits), fill, iters, test, threads);
+        if (v_flag == true) {
+            printf("added %" PRIu64 " primes (%" PRIu64 " bits), %" PRIu64 " in pool\n", added,
+                pool_bits(nbits), pool_count(pooldir, pool_bits(nbits)));
+        }
+        if (v_flag == true) {
+            stats_report(stderr);
+        }
+        if (added < fill) {
+            perror("Error writing prime pool");
+            return 1;
+        }
+        return 0;
+    }
+
+    if (keystore != NULL) {
+        // batch mode: every key has its own derived seed, the global state is never used
+        if (batch == 0 || workers == 0) {
+            print_help();
+            return 1;
+        }
+        char *username = getenv("USER");
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t written = keystore_fill(
+            keystore, batch, nbits, iters, test, workers, seed, username != NULL ? username : "");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%" PRIu64 " keys (%" PRIu64 " bits) in %.3f s with %" PRIu32 " workers: "
+               "%.2f keys/s\n",
+            written, nbits, secs, workers, written / secs);
+        if (v_flag == true) {
+            stats_report(stderr);
+        }
+        if (written < batch) {
+            perror("Error writing keystore");
+            return 1;
+        }
+        return 0;
+    }
+
     FILE *pub_file, *priv_file;
 
     // Create and open "ss.pub" for writing
@@ -101,7 +191,20 @@ int main(int argc, char **argv) {
 
     mpz_t p, q, n, d, pq;
     mpz_inits(p, q, n, d, pq, NULL);
-    ss_make_pub(p, q, n, nbits, iters);
+    // fall back to a fresh search when there is no pool or it has run dry
+    bool pooled = pooldir != NULL && ss_make_pub_pooled(p, q, n, nbits, pooldir);
+    if (!pooled && threads > 1) {
+        ss_make_pub_parallel(p, q, n, nbits, iters, test, threads);
+    } else if (!pooled && test != PRIME_MR) {
+        // other tests are chosen through a workspace; plain -m mr keeps ss_make_pub()'s keys
+        NTWorkspace w;
+        nt_workspace_init(&w, (2 * nbits) / 5 + 1);
+        w.test = test;
+        ss_make_pub_ws(&w, p, q, n, nbits, iters, state);
+        nt_workspace_clear(&w);
+    } else if (!pooled) {
+        ss_make_pub(p, q, n, nbits, iters);
+    }
     ss_make_priv(d, pq, p, q);
 
     char *username = getenv("USER");
@@ -128,5 +231,9 @@ int main(int argc, char **argv) {
 
     randstate_clear();
     mpz_clears(p, q, n, d, pq, NULL);
+    if (v_flag == true) {
+        stats_report(stderr); // counters are only filled in with make STATS=1
+    }
+
     return 0;
 }
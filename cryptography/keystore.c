@@ -0,0 +1,136 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <gmp.h>
+#include <sys/stat.h>
+
+#include "keystore.h"
+#include "numtheory.h"
+#include "randstate.h"
+#include "ss.h"
+
+// State shared by the workers of one keystore_fill() call.
+typedef struct KeystoreRun {
+    const char *dir, *username;
+    uint64_t count, nbits, iters, seed;
+    PrimeTest test;
+    uint64_t next; // next key to hand out
+    uint64_t *bits; // bits of n for every key written, 0 if writing it failed
+    pthread_mutex_t lock;
+} KeystoreRun;
+
+// Writes key i of run. Returns false if either file could not be written.
+static bool keystore_write(KeystoreRun *run, uint64_t i, const mpz_t n, const mpz_t pq,
+    const mpz_t d) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/key-%" PRIu64 ".pub", run->dir, i);
+    FILE *pub_file = fopen(path, "w");
+
+    // created 0600 rather than chmod()ed afterwards, so it is never readable by others
+    snprintf(path, sizeof(path), "%s/key-%" PRIu64 ".priv", run->dir, i);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    FILE *priv_file = fd < 0 ? NULL : fdopen(fd, "w");
+
+    bool ok = pub_file != NULL && priv_file != NULL;
+    if (ok) {
+        ss_write_pub(n, run->username, pub_file);
+        ss_write_priv(pq, d, priv_file);
+    }
+    if (pub_file != NULL) {
+        ok = fclose(pub_file) == 0 && ok;
+    }
+    if (priv_file != NULL) {
+        ok = fclose(priv_file) == 0 && ok;
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    return ok;
+}
+
+static void *keystore_worker(void *arg) {
+    KeystoreRun *run = (KeystoreRun *) arg;
+    NTWorkspace w;
+    nt_workspace_init(&w, (2 * run->nbits) / 5 + 1); // largest prime ss_make_pub_ws() draws
+    w.test = run->test;
+    mpz_t p, q, n, d, pq;
+    mpz_inits(p, q, n, d, pq, NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+        uint64_t i = run->next++;
+        pthread_mutex_unlock(&run->lock);
+        if (i >= run->count) {
+            break;
+        }
+
+        gmp_randstate_t rs;
+        randstate_init_rs(rs, derive_seed(run->seed, i));
+        ss_make_pub_ws(&w, p, q, n, run->nbits, run->iters, rs);
+        ss_make_priv(d, pq, p, q);
+        randstate_clear_rs(rs);
+
+        // each key has its own slot, so no lock is needed
+        run->bits[i] = keystore_write(run, i, n, pq, d) ? mpz_sizeinbase(n, 2) : 0;
+    }
+
+    mpz_clears(p, q, n, d, pq, NULL);
+    nt_workspace_clear(&w);
+    return NULL;
+}
+
+uint64_t keystore_fill(const char *dir, uint64_t count, uint64_t nbits, uint64_t iters,
+    PrimeTest test, uint32_t workers, uint64_t seed, const char *username) {
+    KeystoreRun run = { .dir = dir, .username = username, .count = count, .nbits = nbits,
+        .iters = iters, .seed = seed, .test = test, .lock = PTHREAD_MUTEX_INITIALIZER };
+    run.bits = (uint64_t *) calloc(count, sizeof(uint64_t));
+    if (run.bits == NULL) {
+        return 0;
+    }
+
+    // never more threads than keys, and their handles on the heap whatever -w asked for
+    if (workers > count) {
+        workers = (uint32_t) count;
+    }
+    pthread_t *tids = (pthread_t *) malloc(workers * sizeof(pthread_t));
+    uint32_t started = 0;
+    if (tids == NULL) {
+        workers = 0;
+    }
+    for (; started < workers; started++) {
+        if (pthread_create(&tids[started], NULL, keystore_worker, &run) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        keystore_worker(&run); // no threads to be had, do the work here
+    }
+    for (uint32_t t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+
+    // the index lists keys in order, whichever worker made them
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, KEYSTORE_INDEX);
+    FILE *index = fopen(path, "w");
+    uint64_t written = 0;
+    for (uint64_t i = 0; index != NULL && i < count; i++) {
+        if (run.bits[i] != 0) {
+            // no seed column: anyone who can read the index could rebuild every private key
+            fprintf(index, "%" PRIu64 " key-%" PRIu64 ".pub key-%" PRIu64 ".priv %" PRIu64 "\n",
+                i, i, i, run.bits[i]);
+            written += 1;
+        }
+    }
+    if (index == NULL || fclose(index) != 0) {
+        written = 0;
+    }
+    free(run.bits);
+    return written;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "numtheory.h"
+
+//
+// Directory of generated key pairs: "<dir>/key-<i>.pub" and "<dir>/key-<i>.priv" (mode 0600) in
+// the same formats as ss.pub and ss.priv, for i = 0 .. count - 1, and "<dir>/index" listing one
+// key per line as "<i> <pub file> <priv file> <bits of n>". Key i is generated from the seed
+// derive_seed(seed, i) alone, so a keystore only depends on the seed, not on the number of
+// workers or the order they finish in. That also makes the seed as secret as the private keys,
+// so it is not written anywhere.
+//
+#define KEYSTORE_INDEX "index"
+
+//
+// Generates count key pairs into dir with workers threads, each with its own workspace and
+// random state, then writes the index.
+//
+// Returns the number of key pairs written, which is less than count only on an I/O error.
+//
+// Requires:
+//  dir: existing, writable directory
+//  nbits: minimum # of bits in each n
+//  iters: Miller-Rabin iterations (see make_prime)
+//  test: primality test (see PrimeTest)
+//  username: name written into every public key
+//
+uint64_t keystore_fill(const char *dir, uint64_t count, uint64_t nbits, uint64_t iters,
+    PrimeTest test, uint32_t workers, uint64_t seed, const char *username);
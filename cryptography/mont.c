@@ -0,0 +1,211 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <gmp.h>
+#include "mont.h"
+
+#define MONT_WINDOW   5 // sliding window width
+#define MONT_TABLE    (1 << (MONT_WINDOW - 1)) // odd powers a^1 .. a^(2^w - 1)
+#define MONT_MIN_EXP  64 // shorter exponents are cheaper without the conversions
+
+//
+// Montgomery reduction of the 2L-limb t (destroyed): r = t / R mod n. Each step zeroes the low
+// limb of t with a multiple of n; the carry out of that step is parked in the zeroed limb and all
+// of them are added in at the end.
+//
+static void mont_redc(mp_limb_t *r, mp_limb_t *t, const mp_limb_t *n, mp_limb_t ninv, mp_size_t L) {
+    for (mp_size_t i = 0; i < L; i++) {
+        mp_limb_t u = t[i] * ninv;
+        t[i] = mpn_addmul_1(t + i, n, L, u);
+    }
+    mp_limb_t cy = mpn_add_n(r, t + L, t, L);
+    if (cy != 0 || mpn_cmp(r, n, L) >= 0) {
+        mpn_sub_n(r, r, n, L);
+    }
+}
+
+// r = a * b / R mod n. r may alias a or b.
+static void mont_mul(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, const MontKey *k,
+    mp_size_t L) {
+    mp_limb_t t[2 * MONT_MAX_LIMBS];
+    if (a == b) {
+        mpn_sqr(t, a, L);
+    } else {
+        mpn_mul_n(t, a, b, L);
+    }
+    mont_redc(r, t, k->n, k->ninv, L);
+}
+
+//
+// The exponentiation itself, for a width L fixed by the caller. Every buffer is a fixed-size
+// array on the stack. Left-to-right sliding window over the bits of d, no recoding storage.
+//
+static inline void mont_pow_fixed(
+    mp_limb_t *out, const mp_limb_t *base, const mpz_t d, const MontKey *k, const mp_size_t L) {
+    mp_limb_t table[MONT_TABLE][MONT_MAX_LIMBS];
+    mp_limb_t sq[MONT_MAX_LIMBS];
+    mp_limb_t acc[MONT_MAX_LIMBS];
+    mp_limb_t t[2 * MONT_MAX_LIMBS];
+
+    // table[0] = base * R mod n, table[i] = base^(2i+1) * R mod n
+    mpn_mul_n(t, base, k->r2, L);
+    mont_redc(table[0], t, k->n, k->ninv, L);
+    mont_mul(sq, table[0], table[0], k, L);
+    for (int i = 1; i < MONT_TABLE; i++) {
+        mont_mul(table[i], table[i - 1], sq, k, L);
+    }
+
+    bool started = false;
+    int64_t i = (int64_t) mpz_sizeinbase(d, 2) - 1;
+    if (mpz_sgn(d) == 0) {
+        i = -1;
+    }
+    while (i >= 0) {
+        if (!mpz_tstbit(d, i)) {
+            if (started) {
+                mont_mul(acc, acc, acc, k, L);
+            }
+            i -= 1;
+            continue;
+        }
+        int64_t j = i - MONT_WINDOW + 1 > 0 ? i - MONT_WINDOW + 1 : 0;
+        while (!mpz_tstbit(d, j)) {
+            j += 1;
+        }
+        uint32_t digit = 0;
+        for (int64_t b = i; b >= j; b--) {
+            digit = (digit << 1) | mpz_tstbit(d, b);
+        }
+        if (started) {
+            for (int64_t s = 0; s < i - j + 1; s++) {
+                mont_mul(acc, acc, acc, k, L);
+            }
+            mont_mul(acc, acc, table[digit >> 1], k, L);
+        } else {
+            mpn_copyi(acc, table[digit >> 1], L);
+            started = true;
+        }
+        i = j - 1;
+    }
+
+    // leave Montgomery form; d = 0 gives 1
+    mpn_zero(t, 2 * L);
+    if (started) {
+        mpn_copyi(t, acc, L);
+        mont_redc(out, t, k->n, k->ninv, L);
+    } else {
+        t[0] = 1;
+        mpn_copyi(out, t, L);
+    }
+}
+
+//
+// One instantiation per supported width: L is a compile-time constant in each, so the compiler
+// can specialize the inlined loops for it. A modulus runs in the smallest width that holds it.
+//
+#define MONT_INSTANCE(BITS)                                                                        \
+    static void mont_pow_##BITS(                                                                   \
+        mp_limb_t *out, const mp_limb_t *base, const mpz_t d, const MontKey *k) {                  \
+        mont_pow_fixed(out, base, d, k, (BITS) / GMP_NUMB_BITS);                                   \
+    }
+
+MONT_INSTANCE(512)
+MONT_INSTANCE(1024)
+MONT_INSTANCE(1536)
+MONT_INSTANCE(2048)
+MONT_INSTANCE(3072)
+MONT_INSTANCE(4096)
+
+typedef void (*MontPowFn)(mp_limb_t *, const mp_limb_t *, const mpz_t, const MontKey *);
+
+// Smallest compiled-in width, in limbs, that holds a modulus of limbs limbs; 0 if none does.
+static mp_size_t mont_width(mp_size_t limbs) {
+    static const int widths[] = { 512, 1024, 1536, 2048, 3072, 4096 };
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        if (limbs * GMP_NUMB_BITS <= widths[i]) {
+            return widths[i] / GMP_NUMB_BITS;
+        }
+    }
+    return 0;
+}
+
+// Runtime dispatch on the width.
+static MontPowFn mont_pick(mp_size_t L) {
+    switch (L * GMP_NUMB_BITS) {
+    case 512: return mont_pow_512;
+    case 1024: return mont_pow_1024;
+    case 1536: return mont_pow_1536;
+    case 2048: return mont_pow_2048;
+    case 3072: return mont_pow_3072;
+    default: return mont_pow_4096;
+    }
+}
+
+bool mont_supported(const mpz_t n) {
+    return GMP_NAIL_BITS == 0 && mpz_odd_p(n) && mpz_cmp_ui(n, 1) > 0
+           && mont_width(mpz_size(n)) != 0;
+}
+
+bool mont_key_init(MontKey *k, const mpz_t n) {
+    if (!mont_supported(n)) {
+        return false;
+    }
+    mp_size_t nl = mpz_size(n);
+    mp_size_t L = mont_width(nl);
+    k->limbs = L;
+    k->nlimbs = nl;
+    mpn_zero(k->n, L); // zero-padded up to the width, n < R still holds
+    mpn_copyi(k->n, mpz_limbs_read(n), nl);
+
+    // n^-1 mod 2^64 by Newton iteration, each step doubles the correct low bits
+    mp_limb_t inv = (3 * k->n[0]) ^ 2; // correct to 5 bits
+    for (int i = 0; i < 5; i++) {
+        inv *= 2 - k->n[0] * inv;
+    }
+    k->ninv = -inv;
+
+    // R^2 mod n = 2^(2 L GMP_NUMB_BITS) mod n
+    mp_limb_t r2[2 * MONT_MAX_LIMBS + 1], q[2 * MONT_MAX_LIMBS + 2];
+    mpn_zero(r2, 2 * L);
+    r2[2 * L] = 1;
+    mpn_zero(k->r2, L);
+    mpn_tdiv_qr(q, k->r2, 0, r2, 2 * L + 1, k->n, nl);
+    return true;
+}
+
+bool mont_pow_key(mpz_t o, const mpz_t a, const mpz_t d, const MontKey *k) {
+    mp_size_t L = k->limbs;
+    mp_size_t an = mpz_size(a);
+    if (an > 2 * L) {
+        return false;
+    }
+
+    // base = a mod n, on the stack
+    mp_limb_t base[MONT_MAX_LIMBS], q[2 * MONT_MAX_LIMBS + 1];
+    mpn_zero(base, L);
+    if (an >= k->nlimbs) {
+        mpn_tdiv_qr(q, base, 0, mpz_limbs_read(a), an, k->n, k->nlimbs);
+    } else if (an > 0) {
+        mpn_copyi(base, mpz_limbs_read(a), an);
+    }
+    if (mpz_sgn(a) < 0 && !mpn_zero_p(base, L)) {
+        mpn_sub_n(base, k->n, base, L); // the limbs are |a|, so -|a| mod n = n - (|a| mod n)
+    }
+
+    mp_limb_t out[MONT_MAX_LIMBS];
+    mont_pick(L)(out, base, d, k);
+
+    mp_limb_t *op = mpz_limbs_write(o, L);
+    mpn_copyi(op, out, L);
+    mpz_limbs_finish(o, L);
+    return true;
+}
+
+bool mont_pow(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    if (mpz_sizeinbase(d, 2) < MONT_MIN_EXP || !mont_supported(n)) {
+        return false;
+    }
+    MontKey k;
+    mont_key_init(&k, n);
+    return mont_pow_key(o, a, d, &k);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+
+//
+// Fixed-width Montgomery backend for the common SS sizes. Odd moduli up to 4096 bits run in the
+// smallest of the compiled-in 512/1024/1536/2048/3072/4096-bit widths that holds them, on
+// stack-resident limb arrays with mpn arithmetic, so an exponentiation does no heap allocation.
+// Anything else is left to the mpz code.
+//
+#define MONT_MAX_BITS  4096
+#define MONT_MAX_LIMBS (MONT_MAX_BITS / GMP_NUMB_BITS)
+
+//
+// Per-modulus constants, computed once by mont_key_init().
+//
+typedef struct MontKey {
+    mp_size_t limbs; // L, the fixed width used
+    mp_size_t nlimbs; // limbs actually in n
+    mp_limb_t ninv; // -n^-1 mod 2^GMP_NUMB_BITS
+    mp_limb_t n[MONT_MAX_LIMBS]; // zero-padded to L limbs
+    mp_limb_t r2[MONT_MAX_LIMBS]; // R^2 mod n, R = 2^(L * GMP_NUMB_BITS)
+} MontKey;
+
+//
+// Returns true if n is odd, greater than 1 and at most MONT_MAX_BITS long.
+//
+bool mont_supported(const mpz_t n);
+
+//
+// Fills in k for modulus n. Returns false (k unusable) if !mont_supported(n).
+//
+bool mont_key_init(MontKey *k, const mpz_t n);
+
+//
+// Computes o = a^d mod n for the modulus k was built for. a may be negative or up to 2L limbs
+// long; it is reduced into [0, n) first. Returns false without touching o if a is too long.
+//
+bool mont_pow_key(mpz_t o, const mpz_t a, const mpz_t d, const MontKey *k);
+
+//
+// Computes o = a^d mod n through the fixed-width backend if n is supported and the exponent is
+// long enough to repay the per-call setup. Returns false, without touching o, otherwise.
+//
+bool mont_pow(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
@@ -0,0 +1,179 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// header files
+#include "mont.h"
+#include "numtheory.h"
+#include "randstate.h"
+
+#define OPTIONS "hs:c:" //these are our argument options
+
+void print_help(void) { // helper function for printing help
+    fprintf(stderr,
+
+        "SYNOPSIS\n"
+        "   Checks the fixed-width Montgomery backend (mont_pow, pow_mod_cached) against\n"
+        "   mpz_powm on random and edge-case operands. Exits non-zero on any mismatch.\n"
+        "\n"
+        "USAGE\n"
+        "   ./monttest [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -s seed         Random seed (default: 2024).\n"
+        "   -c count        Random bases per modulus (default: 20).\n");
+
+    return;
+}
+
+static uint64_t checked = 0, failed = 0;
+
+// Compares o against mpz_powm for a^d mod n and reports a mismatch.
+static void check(const char *what, const mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mpz_t want;
+    mpz_init(want);
+    mpz_powm(want, a, d, n);
+    checked += 1;
+    if (mpz_cmp(o, want) != 0) {
+        failed += 1;
+        gmp_fprintf(stderr, "%s mismatch (%zu-bit n)\n  a = %Zx\n  d = %Zx\n  n = %Zx\n", what,
+            mpz_sizeinbase(n, 2), a, d, n);
+    }
+    mpz_clear(want);
+}
+
+// Runs a through every entry point that should agree with mpz_powm(a, d, n).
+static void check_base(const mpz_t a, const mpz_t d, const mpz_t n, PowModCtx *ctx) {
+    mpz_t o;
+    mpz_init(o);
+
+    // mont_pow declines exponents too short to repay its setup; those have no result to check
+    if (mont_pow(o, a, d, n)) {
+        check("mont_pow", o, a, d, n);
+    }
+
+    MontKey k;
+    if (mont_key_init(&k, n) && mpz_size(a) <= 2 * (size_t) k.limbs) {
+        if (!mont_pow_key(o, a, d, &k)) {
+            gmp_fprintf(stderr, "mont_pow_key refused a %zu-bit base\n", mpz_sizeinbase(a, 2));
+            failed += 1;
+        } else {
+            check("mont_pow_key", o, a, d, n);
+        }
+    }
+
+    pow_mod_cached(o, a, ctx);
+    check("pow_mod_cached", o, a, d, n);
+    mpz_clear(o);
+}
+
+// Checks the edge-case bases and count random ones for exponent d and modulus n.
+static void check_modulus(const mpz_t d, const mpz_t n, uint64_t count) {
+    PowModCtx *ctx = pow_mod_ctx_create(d, n);
+    if (ctx == NULL) {
+        perror("pow_mod_ctx_create");
+        exit(EXIT_FAILURE);
+    }
+
+    mpz_t a;
+    mpz_init(a);
+    uint64_t bits = mpz_sizeinbase(n, 2);
+
+    // 0, 1, n - 1, n, n + 1, a random base >= n, and their negatives
+    mpz_set_ui(a, 0);
+    check_base(a, d, n, ctx);
+    mpz_set_ui(a, 1);
+    check_base(a, d, n, ctx);
+    mpz_sub_ui(a, n, 1);
+    check_base(a, d, n, ctx);
+    mpz_set(a, n);
+    check_base(a, d, n, ctx);
+    mpz_add_ui(a, n, 1);
+    check_base(a, d, n, ctx);
+    mpz_urandomb(a, state, 2 * bits - 1);
+    mpz_setbit(a, 2 * bits - 2);
+    check_base(a, d, n, ctx);
+    mpz_neg(a, a);
+    check_base(a, d, n, ctx);
+    mpz_set_si(a, -1);
+    check_base(a, d, n, ctx);
+    mpz_neg(a, n);
+    check_base(a, d, n, ctx);
+
+    for (uint64_t i = 0; i < count; i++) {
+        mpz_urandomm(a, state, n);
+        check_base(a, d, n, ctx);
+    }
+
+    mpz_clear(a);
+    pow_mod_ctx_delete(ctx);
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    uint64_t seed = 2024;
+    uint64_t count = 20;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
+        switch (opt) {
+        case 'h': print_help(); return 0;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            count = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            print_help();
+            return 1;
+            break;
+        }
+    }
+
+    randstate_init(seed);
+    // every compiled-in width of mont.c, and 1300 bits, which runs in the next one up (1536)
+    const uint64_t sizes[] = { 512, 1024, 1300, 1536, 2048, 3072, 4096 };
+
+    mpz_t n, d;
+    mpz_inits(n, d, NULL);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint64_t before = failed;
+
+        // a modulus filling the width and one with a partly used top limb
+        for (uint64_t trim = 0; trim <= 37; trim += 37) {
+            uint64_t bits = sizes[s] - trim;
+            mpz_urandomb(n, state, bits);
+            mpz_setbit(n, bits - 1);
+            mpz_setbit(n, 0);
+
+            // a full-length exponent, a short one mont_pow leaves to mpz, then 0 and 1
+            mpz_urandomb(d, state, bits);
+            check_modulus(d, n, count);
+            mpz_set_ui(d, 65537);
+            check_modulus(d, n, count);
+            mpz_set_ui(d, 0);
+            check_modulus(d, n, 1);
+            mpz_set_ui(d, 1);
+            check_modulus(d, n, 1);
+        }
+
+        // an even modulus of the same size takes pow_mod_cached's non-Montgomery path
+        mpz_urandomb(n, state, sizes[s]);
+        mpz_setbit(n, sizes[s] - 1);
+        mpz_clrbit(n, 0);
+        mpz_urandomb(d, state, sizes[s]);
+        check_modulus(d, n, count);
+
+        printf("%4" PRIu64 " bits: %s\n", sizes[s], failed == before ? "ok" : "FAILED");
+    }
+    printf("%" PRIu64 " checks, %" PRIu64 " mismatches\n", checked, failed);
+
+    mpz_clears(n, d, NULL);
+    randstate_clear();
+    return failed == 0 ? 0 : 1;
+}
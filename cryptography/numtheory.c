@@ -3,163 +3,775 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "randstate.h"
+#include "numtheory.h"
+#include "stats.h"
+#include "smallprimes.h"
+#include "mont.h"
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
+
+void nt_workspace_init(NTWorkspace *w, uint64_t bits) {
+    mpz_t *all[] = { &w->eu_r, &w->eu_r1, &w->eu_o, &w->eu_o1, &w->eu_q, &w->pm_d, &w->pm_p,
+        &w->pm_t, &w->pt_n1, &w->pt_r, &w->pt_a, &w->pt_y, &w->pt_t, &w->pt_u, &w->pt_v,
+        &w->pt_q, &w->mk_base, &w->mk_cand };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if (bits > 0) {
+            mpz_init2(*all[i], 2 * bits + 2 * GMP_NUMB_BITS); // room for a double-width product
+        } else {
+            mpz_init(*all[i]);
+        }
+    }
+    w->test = PRIME_MR;
+    w->candidates = 0;
+}
+
+void nt_workspace_clear(NTWorkspace *w) {
+    mpz_clears(w->eu_r, w->eu_r1, w->eu_o, w->eu_o1, w->eu_q, w->pm_d, w->pm_p, w->pm_t,
+        w->pt_n1, w->pt_r, w->pt_a, w->pt_y, w->pt_t, w->pt_u, w->pt_v, w->pt_q, w->mk_base,
+        w->mk_cand, NULL);
+}
+
+void gcd_ws(NTWorkspace *w, mpz_t g, const mpz_t a, const mpz_t b) {
+    mpz_set(w->eu_r, a);
+    mpz_set(w->eu_r1, b);
+
+    while (mpz_cmp_ui(w->eu_r1, 0) != 0) {
+        mpz_tdiv_r(w->eu_r, w->eu_r, w->eu_r1); // a = a mod b
+        mpz_swap(w->eu_r, w->eu_r1); // (a, b) = (b, a mod b)
+    }
+    mpz_set(g, w->eu_r);
+}
 
 void gcd(mpz_t g, const mpz_t a, const mpz_t b) {
-    mpz_t a2, b2; // create and set new variables equal to the constants
-    mpz_init_set(a2, a);
-    mpz_init_set(b2, b);
+    NTWorkspace w;
+    nt_workspace_init(&w, 0);
+    gcd_ws(&w, g, a, b);
+    nt_workspace_clear(&w);
+}
+
+void mod_inverse_ws(NTWorkspace *w, mpz_t o, const mpz_t a, const mpz_t n) {
+    mpz_set(w->eu_r, n);
+    mpz_set(w->eu_r1, a);
+    mpz_set_ui(w->eu_o, 0);
+    mpz_set_ui(w->eu_o1, 1);
+
+    while (mpz_cmp_ui(w->eu_r1, 0) != 0) {
+        mpz_tdiv_q(w->eu_q, w->eu_r, w->eu_r1); // q = r / r'
 
-    while (mpz_cmp_ui(b2, 0) != 0) {
-        mpz_t t;
-        mpz_init_set(t, b2);
-        mpz_tdiv_r(b2, a2, b2); // b = a mod b
-        mpz_set(a2, t);
-        mpz_clear(t); // create and clear t with every loop
+        mpz_submul(w->eu_r, w->eu_q, w->eu_r1); // r = r - q * r'
+        mpz_swap(w->eu_r, w->eu_r1); // (r, r') = (r', r - q * r')
+
+        mpz_submul(w->eu_o, w->eu_q, w->eu_o1); // o = o - q * o'
+        mpz_swap(w->eu_o, w->eu_o1); // (o, o') = (o', o - q * o')
+    }
+    if (mpz_cmp_ui(w->eu_r, 1) > 0) {
+        mpz_set_ui(w->eu_o, 0);
     }
-    mpz_set(g, a2);
-    mpz_clears(a2, b2, NULL);
+    if (mpz_cmp_ui(w->eu_o, 0) < 0) {
+        mpz_add(w->eu_o, w->eu_o, n);
+    }
+    mpz_set(o, w->eu_o);
 }
 
 void mod_inverse(mpz_t o, const mpz_t a, const mpz_t n) {
-    mpz_t r, r1, o1;
-    mpz_init_set(r, n);
-    mpz_init_set(r1, a);
-    mpz_set_ui(o, 0);
-    mpz_init_set_ui(o1, 1);
+    NTWorkspace w;
+    nt_workspace_init(&w, 0);
+    mod_inverse_ws(&w, o, a, n);
+    nt_workspace_clear(&w);
+}
 
-    while (mpz_cmp_ui(r1, 0) != 0) {
-        mpz_t q, temp, r_temp, o_temp; // r_temp and o_temp are auxiliary variables
-        mpz_inits(q, temp, NULL);
+void pow_mod_ws(NTWorkspace *w, mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    STAT_ADD(STAT_POW_MOD, 1);
+    STAT_ADD(STAT_POW_MOD_BITS, mpz_sizeinbase(d, 2));
+    if (mont_pow(o, a, d, n)) {
+        return; // fixed-width backend took it
+    }
+
+    mpz_set(w->pm_d, d); // d is a const and can't be changed
+    mpz_set(w->pm_p, a);
+    mpz_set_ui(o, 1);
 
-        mpz_tdiv_q(q, r, r1); // q = r / r'
+    while (mpz_sgn(w->pm_d) > 0) {
+        if (mpz_odd_p(w->pm_d)) {
+            mpz_mul(w->pm_t, o, w->pm_p); // temp = o * p
+            mpz_tdiv_r(o, w->pm_t, n); // o = temp mod n
+        }
+        mpz_mul(w->pm_t, w->pm_p, w->pm_p); // temp = p * p
+        mpz_tdiv_r(w->pm_p, w->pm_t, n); // p = temp mod n
+        mpz_tdiv_q_2exp(w->pm_d, w->pm_d, 1);
+    }
+}
 
-        mpz_init_set(r_temp, r);
-        mpz_set(r, r1); // r = r'
-        mpz_mul(temp, q, r1); // temp = q * r'
-        mpz_sub(r1, r_temp, temp); // r' = r - temp
+void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    NTWorkspace w;
+    nt_workspace_init(&w, 0);
+    pow_mod_ws(&w, o, a, d, n);
+    nt_workspace_clear(&w);
+}
 
-        mpz_init_set(o_temp, o);
-        mpz_set(o, o1); // o = o'
-        mpz_mul(temp, q, o1); // temp = q * o'
-        mpz_sub(o1, o_temp, temp); // o' = o - temp
+//
+// Miller-Rabin rounds for a random candidate of the given size, from the Damgard-Landrock-
+// Pomerance error bound for random odd inputs (the same analysis behind the FIPS 186 Appendix C
+// tables). Each entry keeps the error below 2^-80; small sizes fall back to worst-case counts.
+//
+uint64_t mr_rounds_for_bits(uint64_t bits) {
+    if (bits >= 3747) {
+        return 3;
+    } else if (bits >= 1345) {
+        return 4;
+    } else if (bits >= 476) {
+        return 5;
+    } else if (bits >= 400) {
+        return 6;
+    } else if (bits >= 347) {
+        return 7;
+    } else if (bits >= 308) {
+        return 8;
+    } else if (bits >= 55) {
+        return 27;
+    }
+    return 34;
+}
 
-        mpz_clears(q, temp, r_temp, o_temp, NULL);
+//
+// One strong probable-prime round of odd n to base pt_a, with pt_n1 = n - 1 = 2^s * pt_r and
+// pt_v = 2 already set up. Uses pt_y and pt_u.
+//
+static bool strong_round(NTWorkspace *w, const mpz_t n, mp_bitcnt_t s) {
+    STAT_ADD(STAT_MR_ROUNDS, 1);
+    pow_mod_ws(w, w->pt_y, w->pt_a, w->pt_r, n);
+    if ((mpz_cmp_ui(w->pt_y, 1) == 0) || (mpz_cmp(w->pt_y, w->pt_n1) == 0)) {
+        return true;
     }
-    if (mpz_cmp_ui(r, 1) > 0) {
-        mpz_set_ui(o, 0);
+    for (mp_bitcnt_t j = 1; j < s; j++) {
+        pow_mod_ws(w, w->pt_u, w->pt_y, w->pt_v, n); // y = pow_mod(y, 2, n)
+        mpz_swap(w->pt_y, w->pt_u);
+        if (mpz_cmp_ui(w->pt_y, 1) == 0) {
+            return false; // nontrivial square root of 1
+        }
+        if (mpz_cmp(w->pt_y, w->pt_n1) == 0) {
+            return true;
+        }
     }
-    if (mpz_cmp_ui(o, 0) < 0) {
-        mpz_add(o, o, n);
+    return false;
+}
+
+// Writes n - 1 = 2^s * r into pt_n1 and pt_r, sets pt_v = 2 and returns s.
+static mp_bitcnt_t strong_setup(NTWorkspace *w, const mpz_t n) {
+    mpz_sub_ui(w->pt_n1, n, 1);
+    mp_bitcnt_t s = mpz_scan1(w->pt_n1, 0);
+    mpz_tdiv_q_2exp(w->pt_r, w->pt_n1, s);
+    mpz_set_ui(w->pt_v, 2);
+    return s;
+}
+
+// o = x / 2 mod n for odd n, with x already reduced.
+static void half_mod(mpz_t o, const mpz_t x, const mpz_t n) {
+    if (mpz_odd_p(x)) {
+        mpz_add(o, x, n);
+        mpz_tdiv_q_2exp(o, o, 1);
+    } else {
+        mpz_tdiv_q_2exp(o, x, 1);
     }
-    mpz_clears(r, r1, o1, NULL);
 }
 
-void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
-    //initialize the mpz_t variables to be used in this function
-    mpz_t d2, p, temp;
-    mpz_inits(d2, p, temp, NULL);
+//
+// Strong Lucas probable-prime test of odd n > 3 with Selfridge's parameters: the first D in
+// 5, -7, 9, -11, ... with Jacobi(D/n) = -1, P = 1, Q = (1 - D) / 4. With n + 1 = 2^s * d, d odd,
+// n passes if U_d = 0 or V_(d*2^r) = 0 for some 0 <= r < s.
+//
+static bool strong_lucas(NTWorkspace *w, const mpz_t n) {
+    if (mpz_perfect_square_p(n)) {
+        return false; // no D with Jacobi = -1 exists
+    }
 
-    mpz_set(d2, d); //set d2 to d, since d is a const and can't be changed.
-    mpz_set(p, a);
-    mpz_set_ui(o, 1);
+    long D = 5;
+    while (true) {
+        mpz_set_si(w->pt_a, D);
+        int j = mpz_jacobi(w->pt_a, n);
+        if (j == -1) {
+            break;
+        }
+        if (j == 0 && mpz_cmpabs_ui(n, labs(D)) != 0) {
+            return false; // gcd(D, n) is a proper factor
+        }
+        D = D > 0 ? -(D + 2) : -D + 2;
+    }
+    long Q = (1 - D) / 4;
 
-    while (mpz_sgn(d2) > 0) {
-        if (mpz_odd_p(d2)) {
-            mpz_mul(temp, o, p); // temp = o * p
-            mpz_tdiv_r(o, temp, n); // o = temp mod c
+    mpz_ptr d = w->pt_r, U = w->pt_u, V = w->pt_v, Qk = w->pt_q, t = w->pt_t, u = w->pt_y;
+    mpz_add_ui(d, n, 1);
+    mp_bitcnt_t s = mpz_scan1(d, 0);
+    mpz_tdiv_q_2exp(d, d, s);
+
+    // U_1 = 1, V_1 = P = 1, Q^1
+    mpz_set_ui(U, 1);
+    mpz_set_ui(V, 1);
+    mpz_set_si(Qk, Q);
+    mpz_mod(Qk, Qk, n);
+
+    for (int64_t b = (int64_t) mpz_sizeinbase(d, 2) - 2; b >= 0; b--) {
+        // U_2k = U_k V_k, V_2k = V_k^2 - 2 Q^k, Q^2k = (Q^k)^2
+        mpz_mul(U, U, V);
+        mpz_mod(U, U, n);
+        mpz_mul(V, V, V);
+        mpz_submul_ui(V, Qk, 2);
+        mpz_mod(V, V, n);
+        mpz_mul(Qk, Qk, Qk);
+        mpz_mod(Qk, Qk, n);
+
+        if (mpz_tstbit(d, b)) {
+            // U_k+1 = (P U_k + V_k) / 2, V_k+1 = (D U_k + P V_k) / 2, Q^k+1 = Q^k Q
+            mpz_add(t, U, V);
+            mpz_mod(t, t, n);
+            mpz_mul_si(u, U, D);
+            mpz_add(u, u, V);
+            mpz_mod(u, u, n);
+            half_mod(U, t, n);
+            half_mod(V, u, n);
+            mpz_mul_si(Qk, Qk, Q);
+            mpz_mod(Qk, Qk, n);
         }
-        mpz_mul(temp, p, p); // temp = p * p
-        mpz_tdiv_r(p, temp, n); // p = temp mod c
-        mpz_tdiv_q_ui(d2, d2, 2);
     }
-    //free memory of variables
-    mpz_clear(d2);
-    mpz_clear(p);
-    mpz_clear(temp);
+
+    bool probable = mpz_sgn(U) == 0 || mpz_sgn(V) == 0;
+    for (mp_bitcnt_t r = 1; r < s && !probable; r++) {
+        // V_2k = V_k^2 - 2 Q^k
+        mpz_mul(V, V, V);
+        mpz_submul_ui(V, Qk, 2);
+        mpz_mod(V, V, n);
+        mpz_mul(Qk, Qk, Qk);
+        mpz_mod(Qk, Qk, n);
+        probable = mpz_sgn(V) == 0;
+    }
+    return probable;
 }
 
-bool is_prime(const mpz_t n, uint64_t iters) {
-    // corner cases if n = 0, 1, 2, or even
+//
+// Baillie-PSW: trial division by a few small primes, a strong base-2 test and a strong Lucas
+// test. No composite is known to pass it.
+//
+static bool bpsw(NTWorkspace *w, const mpz_t n) {
+    for (int j = 0; j < 24; j++) { // odd primes up to 97
+        if (mpz_cmp_ui(n, small_primes[j]) == 0) {
+            return true;
+        }
+        if (mpz_divisible_ui_p(n, small_primes[j])) {
+            STAT_ADD(STAT_EARLY_REJECTS, 1);
+            return false;
+        }
+    }
+    mp_bitcnt_t s = strong_setup(w, n);
+    mpz_set_ui(w->pt_a, 2);
+    if (!strong_round(w, n, s)) {
+        STAT_ADD(STAT_EARLY_REJECTS, 1);
+        return false;
+    }
+    return strong_lucas(w, n);
+}
+
+bool is_prime_ws(NTWorkspace *w, const mpz_t n, uint64_t iters, gmp_randstate_t rs) {
+    STAT_ADD(STAT_PRIME_TESTS, 1);
+
+    // corner cases if n = 0, 1, 2, 3 or even
     if (mpz_cmp_ui(n, 2) < 0) {
-        return 0;
+        STAT_ADD(STAT_EARLY_REJECTS, 1);
+        return false;
     }
-    if (mpz_cmp_ui(n, 2) == 0) {
-        return 1;
+    if (mpz_cmp_ui(n, 3) <= 0) {
+        return true;
     }
     if (mpz_even_p(n) != 0) {
-        return 0;
+        STAT_ADD(STAT_EARLY_REJECTS, 1);
+        return false;
     }
 
-    // set our variables used to write n - 1 = 2 ^ s * r
-    // set n-1 and s-1, used later
-    mpz_t divisor, s, r, n_1, s_1, range;
-    mpz_init_set_ui(divisor, 1);
-    mpz_inits(n_1, r, s, range, NULL);
-    mpz_sub_ui(range, n, 4); // n - 4
-    mpz_sub_ui(n_1, n, 1); // div n  - 1
+    if (w->test == PRIME_BPSW) {
+        return bpsw(w, n);
+    }
+
+    // n - 1 = 2^s * r
+    mp_bitcnt_t s = strong_setup(w, n);
+    mpz_sub_ui(w->pt_t, n, 4); // n - 4
 
-    while (mpz_even_p(r)) {
-        mpz_div(r, n_1, divisor); // r = (n - 1) / d
-        mpz_mul_ui(divisor, divisor, 2); // update divisor, 2^s = 2(s+1)
-        mpz_add_ui(s, s, 1); // s = (s+1)
+    for (uint64_t i = 0; i < iters; i++) {
+        mpz_urandomm(w->pt_a, rs, w->pt_t); // create a value in [0 - (n - 4)]
+        mpz_add_ui(w->pt_a, w->pt_a, 2); // shift value to the right
+        if (!strong_round(w, n, s)) {
+            STAT_ADD(STAT_EARLY_REJECTS, i == 0);
+            return false;
+        }
     }
+    return true;
+}
 
-    mpz_init(s_1); // s-1 can be calculated after s is found
-    mpz_sub_ui(s_1, s, 1);
+bool is_prime(const mpz_t n, uint64_t iters) {
+    NTWorkspace w;
+    nt_workspace_init(&w, 0);
+    bool prime = is_prime_ws(&w, n, iters, state);
+    nt_workspace_clear(&w);
+    return prime;
+}
+
+#define SIEVE_WINDOW  1024 // odd candidates sieved per pass
+#define SIEVE_PASSES  64 // passes from one starting point before drawing a new one
+#define SIEVE_MINBITS 17 // below this, candidates can collide with the small prime table
 
-    mpz_t random_value, y;
-    mpz_inits(random_value, y, NULL);
+// State shared by the workers of one make_prime_parallel() call.
+typedef struct PrimeSearch {
+    pthread_mutex_t lock;
+    pthread_cond_t settled; // signalled when a claim is settled
+    uint64_t best_index; // global index of the lowest prime found so far
+    uint64_t claimed; // index of the lowest candidate being confirmed, UINT64_MAX if none
+    mpz_t best;
+    uint64_t bits, iters, seed;
+    PrimeTest test;
+    uint32_t threads;
+} PrimeSearch;
 
-    for (uint64_t i = 1; i < iters; i++) {
-        mpz_urandomm(random_value, state, range); // create a value in [0 - (n - 4)]
-        mpz_add_ui(random_value, random_value, 2); // shift value to the right
-        pow_mod(y, random_value, r, n);
+//
+// True if a prime with an index below index has been found, so candidate index cannot win. While
+// a lower candidate that passed one round is being confirmed, waits for the outcome rather than
+// testing a candidate that almost certainly cannot win.
+//
+static bool search_lost(PrimeSearch *s, uint64_t index) {
+    pthread_mutex_lock(&s->lock);
+    while (index > s->claimed && index < s->best_index) {
+        pthread_cond_wait(&s->settled, &s->lock);
+    }
+    bool lost = index > s->best_index;
+    pthread_mutex_unlock(&s->lock);
+    return lost;
+}
 
-        if ((mpz_cmp_ui(y, 1) != 0) && (mpz_cmp(y, n_1) != 0)) {
-            mpz_t j, two, temp_y;
-            mpz_init_set_ui(j, 1);
-            mpz_init_set_ui(two, 2);
-            mpz_init(temp_y);
+// Records the outcome of confirming candidate index: a prime in p, or a composite.
+static void search_settle(PrimeSearch *s, uint64_t index, bool prime, const mpz_t p) {
+    pthread_mutex_lock(&s->lock);
+    if (prime && index < s->best_index) {
+        s->best_index = index;
+        mpz_set(s->best, p);
+    }
+    if (s->claimed == index) {
+        s->claimed = UINT64_MAX;
+    }
+    pthread_cond_broadcast(&s->settled);
+    pthread_mutex_unlock(&s->lock);
+}
 
-            while ((mpz_cmp(j, s_1) <= 0) && (mpz_cmp(y, n_1) != 0)) {
-                pow_mod(temp_y, y, two, n); // y = pow_mod(y, 2, n)
-                mpz_set(y, temp_y);
+//
+// Where one searcher stands in a candidate sequence. Candidates are numbered in sequence order;
+// a searcher only tests those whose index is its own modulo threads, drawing Miller-Rabin
+// witnesses from rs. Every searcher of a search walks the same sequence, drawn from its own
+// copy of the same base stream, so together they test each candidate exactly once.
+//
+typedef struct PrimeCursor {
+    gmp_randstate_t *base_rs; // starting points, or single candidates for small sizes
+    gmp_randstate_t *rs; // witnesses
+    PrimeSearch *search; // NULL for a lone searcher, which tests every candidate
+    uint32_t id, threads;
+    uint64_t index; // index of the next candidate
+} PrimeCursor;
 
-                if (mpz_cmp_ui(y, 1) == 0) {
-                    mpz_clears(j, two, y, temp_y, r, s, random_value, divisor, n_1, s_1, range,
-                        NULL); // clear all values
-                    return false;
-                }
-                mpz_add_ui(j, j, 1);
-            }
+// Takes the next candidate index, returning 1 if it is c's to test, 0 if it belongs to another
+// searcher and -1 if a lower index has already won.
+static int cursor_next(PrimeCursor *c) {
+    uint64_t index = c->index++;
+    if (index % c->threads != c->id) {
+        return 0;
+    }
+    return c->search != NULL && search_lost(c->search, index) ? -1 : 1;
+}
+
+//
+// Tests candidate w->mk_cand, storing it in p if it is prime. Being a random candidate, it gets
+// the sized round count in PRIME_MR_SIZED mode. In a parallel search, a candidate that passes one
+// Miller-Rabin round is claimed before the remaining rounds, so the other workers stop at it
+// instead of testing candidates it would beat, and the outcome is recorded.
+//
+static bool test_candidate(NTWorkspace *w, mpz_t p, uint64_t iters, PrimeCursor *c) {
+    w->candidates += 1;
+    STAT_ADD(STAT_CANDIDATES, 1);
+    if (w->test == PRIME_MR_SIZED) {
+        iters = mr_rounds_for_bits(mpz_sizeinbase(w->mk_cand, 2));
+    }
+    PrimeSearch *s = c->search;
+    uint64_t index = c->index - 1;
+    if (s != NULL && w->test != PRIME_BPSW) {
+        bool probable = is_prime_ws(w, w->mk_cand, 1, *c->rs);
+        if (!probable) {
+            return false;
+        }
+        pthread_mutex_lock(&s->lock);
+        if (index < s->claimed) {
+            s->claimed = index;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    bool prime = is_prime_ws(w, w->mk_cand, iters, *c->rs);
+    if (prime) {
+        mpz_set(p, w->mk_cand);
+    }
+    if (s != NULL) {
+        search_settle(s, index, prime, p);
+    }
+    return prime;
+}
+
+//
+// Looks for a prime among the odd numbers following a random bits-bit starting point with the
+// top and low bits forced. Each pass crosses off multiples of the small primes in a window of
+// SIEVE_WINDOW odd candidates, and only survivors go to Miller-Rabin. The residues of the window
+// start are computed once and then advanced by 2 * SIEVE_WINDOW per pass, so no big-number
+// division is needed after the first pass.
+//
+// Returns 1 if c found a prime, 0 if the run left the bits-bit range or SIEVE_PASSES without
+// one, or -1 if a candidate below c's next one has won.
+//
+static int sieve_search(NTWorkspace *w, mpz_t p, uint64_t bits, uint64_t iters, PrimeCursor *c) {
+    uint16_t residues[SMALL_PRIMES];
+    uint8_t composite[SIEVE_WINDOW];
+
+    mpz_urandomb(w->mk_base, *c->base_rs, bits);
+    mpz_setbit(w->mk_base, bits - 1);
+    mpz_setbit(w->mk_base, 0);
+    for (int j = 0; j < SMALL_PRIMES; j++) {
+        residues[j] = mpz_fdiv_ui(w->mk_base, small_primes[j]);
+    }
+
+    for (int pass = 0; pass < SIEVE_PASSES; pass++) {
+        memset(composite, 0, sizeof(composite));
+        for (int j = 0; j < SMALL_PRIMES; j++) {
+            uint32_t prime = small_primes[j];
+            uint32_t r = residues[j];
 
-            mpz_clears(j, two, temp_y, NULL);
-            if (mpz_cmp(y, n_1) != 0) {
+            // first i with base + 2i = 0 (mod prime), using 2^-1 = (prime + 1) / 2
+            uint32_t i = (uint32_t) (((uint64_t) (prime - r) * ((prime + 1) / 2)) % prime);
+            for (; i < SIEVE_WINDOW; i += prime) {
+                composite[i] = 1;
+            }
+            residues[j] = (r + 2 * SIEVE_WINDOW) % prime;
+        }
 
-                mpz_clears(y, r, s, random_value, divisor, n_1, s_1, range,
-                    NULL); // clear all values
-                return false;
+        for (uint32_t i = 0; i < SIEVE_WINDOW; i++) {
+            if (composite[i]) {
+                continue;
+            }
+            mpz_add_ui(w->mk_cand, w->mk_base, 2 * i);
+            if (mpz_sizeinbase(w->mk_cand, 2) > bits) {
+                return 0; // ran off the top of the range
+            }
+            int mine = cursor_next(c);
+            if (mine < 0) {
+                return -1;
+            }
+            if (mine && test_candidate(w, p, iters, c)) {
+                return 1;
             }
         }
+        mpz_add_ui(w->mk_base, w->mk_base, 2 * SIEVE_WINDOW);
     }
+    return 0;
+}
 
-    // clear variables at the end
-    mpz_clears(y, r, s, random_value, divisor, n_1, s_1, range, NULL);
-    return true;
+// One search attempt: a single random candidate for small sizes, a sieved run otherwise.
+// Returns as sieve_search() does.
+static int prime_attempt(NTWorkspace *w, mpz_t p, uint64_t bits, uint64_t iters, PrimeCursor *c) {
+    if (bits < SIEVE_MINBITS) {
+        mpz_urandomb(w->mk_cand, *c->base_rs, bits);
+        int mine = cursor_next(c);
+        if (mine <= 0) {
+            return mine;
+        }
+        return test_candidate(w, p, iters, c) ? 1 : 0;
+    }
+    return sieve_search(w, p, bits, iters, c);
+}
+
+void make_prime_ws(NTWorkspace *w, mpz_t p, uint64_t bits, uint64_t iters, gmp_randstate_t rs) {
+    PrimeCursor c = { .base_rs = (gmp_randstate_t *) rs, .rs = (gmp_randstate_t *) rs,
+        .search = NULL, .id = 0, .threads = 1, .index = 0 };
+    while (prime_attempt(w, p, bits, iters, &c) == 0) {
+    }
+    STAT_ADD(STAT_PRIMES, 1);
 }
 
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
-    mpz_t rand_num;
-    mpz_init(rand_num);
+    NTWorkspace w;
+    nt_workspace_init(&w, bits);
+    make_prime_ws(&w, p, bits, iters, state);
+    nt_workspace_clear(&w);
+}
+
+// Mixes a seed and a stream number into an independent 64-bit seed (splitmix64 finalizer).
+uint64_t derive_seed(uint64_t seed, uint64_t stream) {
+    uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+typedef struct PrimeWorker {
+    PrimeSearch *search;
+    uint32_t id;
+} PrimeWorker;
+
+//
+// All workers walk one candidate sequence, drawn from stream 0 of the seed, and worker w tests
+// candidates w, w + T, w + 2T, ... with witnesses from stream w + 1. The winner is the prime
+// with the lowest index, not the first to finish, so the result does not depend on scheduling.
+// A worker stops as soon as its next candidate is past the best one found, so beyond the serial
+// search's work each worker wastes at most the candidate it is testing.
+//
+static void *prime_worker(void *arg) {
+    PrimeWorker *pw = (PrimeWorker *) arg;
+    PrimeSearch *s = pw->search;
+
+    gmp_randstate_t base_rs, rs;
+    randstate_init_rs(base_rs, derive_seed(s->seed, 0));
+    randstate_init_rs(rs, derive_seed(s->seed, (uint64_t) pw->id + 1));
+    NTWorkspace w;
+    nt_workspace_init(&w, s->bits);
+    w.test = s->test;
+
+    mpz_t candidate;
+    mpz_init(candidate);
+
+    PrimeCursor c = { .base_rs = &base_rs, .rs = &rs, .search = s, .id = pw->id,
+        .threads = s->threads, .index = 0 };
+    while (prime_attempt(&w, candidate, s->bits, s->iters, &c) == 0) {
+    }
+
+    mpz_clear(candidate);
+    nt_workspace_clear(&w);
+    randstate_clear_rs(base_rs);
+    randstate_clear_rs(rs);
+    return NULL;
+}
+
+void make_prime_parallel(
+    mpz_t p, uint64_t bits, uint64_t iters, PrimeTest test, uint32_t threads, uint64_t seed) {
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    PrimeSearch search;
+    pthread_mutex_init(&search.lock, NULL);
+    pthread_cond_init(&search.settled, NULL);
+    search.best_index = UINT64_MAX;
+    search.claimed = UINT64_MAX;
+    mpz_init(search.best);
+    search.bits = bits;
+    search.iters = iters;
+    search.test = test;
+    search.seed = seed;
+    search.threads = threads;
+
+    pthread_t *tids = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    PrimeWorker *workers = (PrimeWorker *) malloc(threads * sizeof(PrimeWorker));
+    if (tids == NULL || workers == NULL) {
+        perror("Failed to allocate prime search workers");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < threads; i++) {
+        workers[i].search = &search;
+        workers[i].id = i;
+        if (pthread_create(&tids[i], NULL, prime_worker, &workers[i]) != 0) {
+            perror("Failed to start prime search worker");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    mpz_set(p, search.best);
+    STAT_ADD(STAT_PRIMES, 1);
+    mpz_clear(search.best);
+    pthread_mutex_destroy(&search.lock);
+    pthread_cond_destroy(&search.settled);
+    free(tids);
+    free(workers);
+}
+
+// Reduces t (< n * R) in place: Montgomery REDC for odd n, plain remainder otherwise.
+static void ctx_reduce(PowModCtx *ctx, mpz_t t) {
+    if (!ctx->mont) {
+        mpz_tdiv_r(t, t, ctx->n);
+        return;
+    }
+    mpz_fdiv_r_2exp(ctx->m, t, ctx->rbits); // m = t mod R
+    mpz_mul(ctx->m, ctx->m, ctx->n_prime);
+    mpz_fdiv_r_2exp(ctx->m, ctx->m, ctx->rbits); // m = (t mod R) * n' mod R
+    mpz_addmul(t, ctx->m, ctx->n); // t + m * n is divisible by R
+    mpz_tdiv_q_2exp(t, t, ctx->rbits);
+    if (mpz_cmp(t, ctx->n) >= 0) {
+        mpz_sub(t, t, ctx->n);
+    }
+}
+
+// o = a * b in whatever form the context works in.
+static void ctx_mul(PowModCtx *ctx, mpz_t o, const mpz_t a, const mpz_t b) {
+    mpz_mul(ctx->t, a, b);
+    ctx_reduce(ctx, ctx->t);
+    mpz_swap(o, ctx->t);
+}
+
+// Picks a window width that keeps table setup small next to the exponent length.
+static uint32_t window_size(uint64_t bits) {
+    if (bits > 1536) {
+        return 6;
+    } else if (bits > 512) {
+        return 5;
+    } else if (bits > 128) {
+        return 4;
+    } else if (bits > 24) {
+        return 3;
+    }
+    return 1;
+}
+
+PowModCtx *pow_mod_ctx_create(const mpz_t d, const mpz_t n) {
+    PowModCtx *ctx = (PowModCtx *) calloc(1, sizeof(PowModCtx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    // Recode the exponent into left-to-right sliding windows.
+    uint64_t bits = mpz_sgn(d) > 0 ? mpz_sizeinbase(d, 2) : 0;
+    ctx->wsize = window_size(bits);
+    ctx->steps = (PowModStep *) malloc((bits + 1) * sizeof(PowModStep));
+    ctx->table = (mpz_t *) malloc(((size_t) 1 << (ctx->wsize - 1)) * sizeof(mpz_t));
+    if (ctx->steps == NULL || ctx->table == NULL) {
+        free(ctx->steps);
+        free(ctx->table);
+        free(ctx);
+        return NULL;
+    }
+
+    uint32_t pending = 0;
+    int64_t i = (int64_t) bits - 1;
+    while (i >= 0) {
+        if (!mpz_tstbit(d, i)) {
+            pending += 1;
+            i -= 1;
+            continue;
+        }
+        int64_t j = i - ctx->wsize + 1 > 0 ? i - ctx->wsize + 1 : 0;
+        while (!mpz_tstbit(d, j)) {
+            j += 1; // windows end on a set bit so the digit is odd
+        }
+        uint32_t digit = 0;
+        for (int64_t b = i; b >= j; b--) {
+            digit = (digit << 1) | mpz_tstbit(d, b);
+        }
+        ctx->steps[ctx->nsteps].squares = ctx->nsteps == 0 ? 0 : pending + (uint32_t) (i - j + 1);
+        ctx->steps[ctx->nsteps].digit = digit;
+        ctx->nsteps += 1;
+        pending = 0;
+        i = j - 1;
+    }
+    ctx->tail = pending;
+
+    // Modulus constants and preallocated scratch, sized for a double-width product.
+    ctx->rbits = mpz_size(n) * GMP_NUMB_BITS;
+    mp_bitcnt_t width = 2 * ctx->rbits + 2 * GMP_NUMB_BITS;
+    mpz_init_set(ctx->n, n);
+    mpz_inits(ctx->n_prime, ctx->r2, ctx->one, NULL);
+    mpz_init2(ctx->acc, width);
+    mpz_init2(ctx->t, width);
+    mpz_init2(ctx->m, width);
+    for (size_t k = 0; k < ((size_t) 1 << (ctx->wsize - 1)); k++) {
+        mpz_init2(ctx->table[k], width);
+    }
+
+    // Common key sizes go to the fixed-width backend, which keeps its own constants.
+    mpz_init_set(ctx->d, d);
+    if (mont_supported(n)) {
+        ctx->fixed = (MontKey *) malloc(sizeof(MontKey));
+        if (ctx->fixed != NULL) {
+            mont_key_init(ctx->fixed, n);
+        }
+    }
+
+    ctx->mont = mpz_odd_p(n) && mpz_cmp_ui(n, 1) > 0;
+    if (ctx->mont) {
+        mpz_t r;
+        mpz_init(r);
+        mpz_setbit(r, ctx->rbits); // R = 2^rbits
+        mpz_invert(ctx->n_prime, n, r);
+        mpz_sub(ctx->n_prime, r, ctx->n_prime); // n' = R - n^-1
+        mpz_mod(ctx->one, r, n);
+        mpz_mul(ctx->r2, ctx->one, ctx->one);
+        mpz_mod(ctx->r2, ctx->r2, n);
+        mpz_clear(r);
+    } else {
+        mpz_set_ui(ctx->one, 1);
+        mpz_set_ui(ctx->r2, 1);
+    }
+    return ctx;
+}
+
+void pow_mod_ctx_delete(PowModCtx *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    for (size_t k = 0; k < ((size_t) 1 << (ctx->wsize - 1)); k++) {
+        mpz_clear(ctx->table[k]);
+    }
+    mpz_clears(ctx->n, ctx->d, ctx->n_prime, ctx->r2, ctx->one, ctx->acc, ctx->t, ctx->m, NULL);
+    free(ctx->fixed);
+    free(ctx->table);
+    free(ctx->steps);
+    free(ctx);
+}
+
+void pow_mod_cached(mpz_t o, const mpz_t a, PowModCtx *ctx) {
+    STAT_ADD(STAT_POW_MOD, 1);
+    STAT_ADD(STAT_POW_MOD_BITS, mpz_sizeinbase(ctx->d, 2));
+    if (mpz_cmp_ui(ctx->n, 1) == 0) {
+        mpz_set_ui(o, 0);
+        return;
+    }
+    if (ctx->nsteps == 0) {
+        mpz_set_ui(o, 1); // a^0
+        return;
+    }
+    if (ctx->fixed != NULL && mont_pow_key(o, a, ctx->d, ctx->fixed)) {
+        return;
+    }
 
-    // generate a random number of bits length
-    mpz_urandomb(rand_num, state, bits);
+    // table[0] = a in working form, table[k] = a^(2k+1)
+    mpz_mod(ctx->acc, a, ctx->n);
+    if (ctx->mont) {
+        ctx_mul(ctx, ctx->table[0], ctx->acc, ctx->r2);
+    } else {
+        mpz_set(ctx->table[0], ctx->acc);
+    }
+    size_t entries = (size_t) 1 << (ctx->wsize - 1);
+    if (entries > 1) {
+        ctx_mul(ctx, ctx->acc, ctx->table[0], ctx->table[0]); // a^2
+        for (size_t k = 1; k < entries; k++) {
+            ctx_mul(ctx, ctx->table[k], ctx->table[k - 1], ctx->acc);
+        }
+    }
 
-    while (!is_prime(rand_num, iters)) {
+    mpz_set(ctx->acc, ctx->table[ctx->steps[0].digit >> 1]);
+    for (uint32_t s = 1; s < ctx->nsteps; s++) {
+        for (uint32_t k = 0; k < ctx->steps[s].squares; k++) {
+            ctx_mul(ctx, ctx->acc, ctx->acc, ctx->acc);
+        }
+        ctx_mul(ctx, ctx->acc, ctx->acc, ctx->table[ctx->steps[s].digit >> 1]);
+    }
+    for (uint32_t k = 0; k < ctx->tail; k++) {
+        ctx_mul(ctx, ctx->acc, ctx->acc, ctx->acc);
+    }
 
-        mpz_urandomb(rand_num, state, bits);
+    if (ctx->mont) {
+        ctx_reduce(ctx, ctx->acc); // leave Montgomery form
     }
-    mpz_set(p, rand_num);
-    mpz_clear(rand_num);
+    mpz_set(o, ctx->acc);
 }
@@ -4,6 +4,58 @@
 #include <gmp.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include "mont.h"
+
+//
+// Primality test of a workspace (NTWorkspace.test) or a parallel search:
+//  PRIME_MR:       iters rounds of Miller-Rabin with random bases
+//  PRIME_MR_SIZED: make_prime_ws() and make_prime_parallel() test the random candidates they
+//                  draw with the round count from mr_rounds_for_bits(), iters ignored. That
+//                  count is only sound for random candidates, so is_prime_ws() runs iters rounds
+//                  on any other input, as with PRIME_MR.
+//  PRIME_BPSW:     Baillie-PSW (strong base-2 test plus strong Lucas test), iters ignored
+//
+// is_prime() and make_prime() always use PRIME_MR.
+//
+typedef enum { PRIME_MR, PRIME_MR_SIZED, PRIME_BPSW } PrimeTest;
+
+//
+// Scratch integers for the *_ws functions, so their loops never allocate. Each thread needs its
+// own workspace; one workspace may be reused for any number of calls.
+//
+typedef struct NTWorkspace {
+    mpz_t eu_r, eu_r1, eu_o, eu_o1, eu_q; // gcd and mod_inverse
+    mpz_t pm_d, pm_p, pm_t; // pow_mod
+    mpz_t pt_n1, pt_r, pt_a, pt_y, pt_t, pt_u, pt_v, pt_q; // primality tests
+    mpz_t mk_base, mk_cand; // make_prime
+    PrimeTest test; // primality test to use, PRIME_MR after nt_workspace_init()
+    uint64_t candidates; // numbers make_prime_ws() has sent to the primality test so far
+} NTWorkspace;
+
+//
+// Initializes a workspace with every scratch integer preallocated for products of two bits-bit
+// numbers (pass the modulus size). bits = 0 allocates lazily on first use.
+//
+void nt_workspace_init(NTWorkspace *w, uint64_t bits);
+
+//
+// Frees all memory used by the workspace.
+//
+void nt_workspace_clear(NTWorkspace *w);
+
+//
+// Reentrant versions: same results as the functions below, using w for all temporaries and
+// drawing randomness only from the caller-owned rs (see randstate_init_rs()).
+//
+void gcd_ws(NTWorkspace *w, mpz_t g, const mpz_t a, const mpz_t b);
+
+void mod_inverse_ws(NTWorkspace *w, mpz_t o, const mpz_t a, const mpz_t n);
+
+void pow_mod_ws(NTWorkspace *w, mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
+
+bool is_prime_ws(NTWorkspace *w, const mpz_t n, uint64_t iters, gmp_randstate_t rs);
+
+void make_prime_ws(NTWorkspace *w, mpz_t p, uint64_t bits, uint64_t iters, gmp_randstate_t rs);
 
 void gcd(mpz_t g, const mpz_t a, const mpz_t b);
 
@@ -11,6 +63,72 @@ void mod_inverse(mpz_t o, const mpz_t a, const mpz_t n);
 
 void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
 
+//
+// Miller-Rabin rounds needed for an error below 2^-80 on a random odd candidate of bits bits.
+//
+uint64_t mr_rounds_for_bits(uint64_t bits);
+
 bool is_prime(const mpz_t n, uint64_t iters);
 
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
+
+//
+// Derives the seed for stream number stream from seed. Distinct streams give unrelated seeds.
+//
+uint64_t derive_seed(uint64_t seed, uint64_t stream);
+
+//
+// Finds a random prime of bits bits with primality test test using threads workers, which split
+// the tests of one candidate sequence derived from seed. The first prime in candidate order wins,
+// so the result only depends on bits, test and seed, not on threads or scheduling. Does not touch
+// the global random state.
+//
+void make_prime_parallel(
+    mpz_t p, uint64_t bits, uint64_t iters, PrimeTest test, uint32_t threads, uint64_t seed);
+
+//
+// Precomputed state for raising many bases to the same exponent d modulo the same n.
+//
+// The exponent is recoded once into sliding-window steps, the Montgomery constants for n are
+// computed once (odd n only, even n falls back to plain division), and the window table and
+// temporaries are allocated once at full size so pow_mod_cached() does no allocation. Moduli of
+// a size the fixed-width backend (mont.h) supports are handed to it instead.
+//
+typedef struct PowModStep {
+    uint32_t squares; // squarings to do before the multiply
+    uint32_t digit; // odd window value to multiply by
+} PowModStep;
+
+typedef struct PowModCtx {
+    mpz_t n; // modulus
+    mpz_t d; // exponent
+    MontKey *fixed; // fixed-width backend constants, NULL if n is not a supported size
+    bool mont; // true if Montgomery reduction is used (n odd)
+    uint64_t rbits; // R = 2^rbits
+    mpz_t n_prime; // -n^-1 mod R
+    mpz_t r2; // R^2 mod n, converts into Montgomery form
+    mpz_t one; // 1 in Montgomery form (R mod n)
+    PowModStep *steps; // recoded exponent, most significant window first
+    uint32_t nsteps;
+    uint32_t tail; // squarings left after the last step
+    uint32_t wsize; // window width in bits
+    mpz_t *table; // odd powers a^1, a^3, ..., a^(2^wsize - 1)
+    mpz_t acc, t, m; // scratch
+} PowModCtx;
+
+//
+// Builds the precomputed state for exponent d and modulus n.
+// Returns NULL if memory could not be allocated.
+//
+PowModCtx *pow_mod_ctx_create(const mpz_t d, const mpz_t n);
+
+//
+// Frees all memory used by ctx.
+//
+void pow_mod_ctx_delete(PowModCtx *ctx);
+
+//
+// Computes o = a^d mod n with the d and n the context was built for.
+// Not reentrant: ctx holds the scratch space.
+//
+void pow_mod_cached(mpz_t o, const mpz_t a, PowModCtx *ctx);
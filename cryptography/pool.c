@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gmp.h>
+#include <sys/file.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+#include "numtheory.h"
+#include "pool.h"
+#include "randstate.h"
+
+uint64_t pool_bits(uint64_t nbits) {
+    // n = p * p * q has at least 3 * bits - 2 bits, and this stays inside the
+    // [nbits / 5, 2 * nbits / 5] range ss_make_pub draws from
+    return (nbits + 4) / 3;
+}
+
+// Opens the pool file for bits and takes the lock. Returns -1 on failure.
+static int pool_open(const char *dir, uint64_t bits, int flags) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/primes-%" PRIu64 ".pool", dir, bits);
+    int fd = open(path, flags, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads the whole locked pool file into a NUL-terminated buffer. Returns NULL on failure.
+static char *pool_slurp(int fd, off_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return NULL;
+    }
+    char *buf = (char *) malloc(st.st_size + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+    off_t got = 0;
+    while (got < st.st_size) {
+        ssize_t r = pread(fd, buf + got, st.st_size - got, got);
+        if (r <= 0) {
+            free(buf);
+            return NULL;
+        }
+        got += r;
+    }
+    buf[got] = '\0';
+    *size = got;
+    return buf;
+}
+
+// Seeds rs from the kernel, so that fills never repeat one another's primes the way two runs
+// from the same time(NULL) or -s seed would. Returns false if no randomness is available.
+static bool pool_seed(gmp_randstate_t rs) {
+    uint8_t bytes[32];
+    if (getrandom(bytes, sizeof(bytes), 0) != (ssize_t) sizeof(bytes)) {
+        return false;
+    }
+    mpz_t seed;
+    mpz_init(seed);
+    mpz_import(seed, sizeof(bytes), 1, sizeof(uint8_t), 1, 0, bytes);
+    gmp_randinit_mt(rs);
+    gmp_randseed(rs, seed);
+    mpz_clear(seed);
+    memset(bytes, 0, sizeof(bytes));
+    return true;
+}
+
+uint64_t pool_fill(const char *dir, uint64_t bits, uint64_t count, uint64_t iters, PrimeTest test,
+    uint32_t threads) {
+    gmp_randstate_t rs;
+    if (!pool_seed(rs)) {
+        return 0;
+    }
+    NTWorkspace w;
+    nt_workspace_init(&w, bits);
+    w.test = test;
+    mpz_t p;
+    mpz_init(p);
+
+    uint64_t added = 0;
+    while (added < count) {
+        if (threads > 1) {
+            uint64_t seed = gmp_urandomb_ui(rs, 32);
+            seed = (seed << 32) | gmp_urandomb_ui(rs, 32);
+            make_prime_parallel(p, bits, iters, test, threads, seed);
+        } else {
+            make_prime_ws(&w, p, bits, iters, rs);
+        }
+
+        // our own buffer, with room for the newline, rather than one from GMP's allocator
+        char *line = (char *) malloc(mpz_sizeinbase(p, 16) + 2);
+        if (line == NULL) {
+            break;
+        }
+        mpz_get_str(line, 16, p);
+        size_t len = strlen(line);
+        line[len] = '\n';
+        line[len + 1] = '\0';
+
+        // Hold the lock only for the append, not for the search. The pool is not searched for
+        // the prime: from a getrandom() seed a repeat is as likely as guessing one, and
+        // pool_take_pair() callers never pair a prime with itself.
+        int fd = pool_open(dir, bits, O_WRONLY | O_CREAT | O_APPEND);
+        bool ok = fd >= 0 && write(fd, line, len + 1) == (ssize_t) (len + 1);
+        free(line);
+        if (fd >= 0) {
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+        if (!ok) {
+            break;
+        }
+        added += 1;
+    }
+
+    mpz_clear(p);
+    nt_workspace_clear(&w);
+    gmp_randclear(rs);
+    return added;
+}
+
+// Reads the last prime that ends at or before offset end of the locked pool file fd into p and
+// sets *start to the offset its line begins at, so the caller can truncate it away. Only the
+// end of the range is read. Returns false, leaving p untouched, if there is none.
+static bool pool_peek(int fd, uint64_t bits, off_t end, mpz_t p, off_t *start) {
+    // a line is bits / 4 hex digits and a newline; read that much and widen the window only if
+    // the file holds something longer
+    off_t window = (off_t) bits / 4 + 8;
+    char *buf = NULL;
+    bool found = false;
+    for (;;) {
+        off_t from = end > window ? end - window : 0;
+        off_t want = end - from;
+        char *grown = (char *) realloc(buf, want + 1);
+        if (grown == NULL) {
+            break;
+        }
+        buf = grown;
+        if (pread(fd, buf, want, from) != (ssize_t) want) {
+            break;
+        }
+
+        // drop trailing newlines, then take the last line
+        off_t last = want;
+        while (last > 0 && buf[last - 1] == '\n') {
+            last -= 1;
+        }
+        off_t first = last;
+        while (first > 0 && buf[first - 1] != '\n') {
+            first -= 1;
+        }
+        if (first == 0 && from > 0) {
+            window *= 2; // the line may begin before the window
+            continue;
+        }
+        buf[last] = '\0';
+        found = last > first && mpz_set_str(p, buf + first, 16) == 0;
+        *start = from + first;
+        break;
+    }
+    free(buf);
+    return found;
+}
+
+bool pool_take(const char *dir, uint64_t bits, mpz_t p) {
+    int fd = pool_open(dir, bits, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    off_t start = 0;
+    bool taken = fstat(fd, &st) == 0 && pool_peek(fd, bits, st.st_size, p, &start)
+                 && ftruncate(fd, start) == 0;
+    flock(fd, LOCK_UN);
+    close(fd);
+    return taken;
+}
+
+bool pool_take_pair(const char *dir, uint64_t bits, mpz_t p, mpz_t q,
+    bool (*usable)(const mpz_t p, const mpz_t q)) {
+    int fd = pool_open(dir, bits, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+
+    // both primes come out under one lock and nothing is removed until a pair is found, so a p
+    // without a partner stays in the pool; primes rejected as its partner are dropped with it
+    struct stat st;
+    off_t start = 0;
+    bool found = false;
+    if (fstat(fd, &st) == 0 && pool_peek(fd, bits, st.st_size, p, &start)) {
+        while (!found && pool_peek(fd, bits, start, q, &start)) {
+            found = usable(p, q);
+        }
+    }
+    found = found && ftruncate(fd, start) == 0;
+    flock(fd, LOCK_UN);
+    close(fd);
+    return found;
+}
+
+uint64_t pool_count(const char *dir, uint64_t bits) {
+    int fd = pool_open(dir, bits, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    off_t size = 0;
+    char *buf = pool_slurp(fd, &size);
+    uint64_t lines = 0;
+    for (off_t i = 0; buf != NULL && i < size; i++) {
+        lines += buf[i] == '\n';
+    }
+    free(buf);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return lines;
+}
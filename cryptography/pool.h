@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+
+//
+// On-disk pool of verified primes, one file per bit size ("<dir>/primes-<bits>.pool", one hex
+// prime per line, mode 0600). Every access holds an exclusive flock() on the file, so any number
+// of fillers and consumers can share a pool. Consumed primes are removed from the file.
+//
+
+//
+// Bit size of the pool primes used for keys with a public modulus of at least nbits bits.
+//
+uint64_t pool_bits(uint64_t nbits);
+
+//
+// Generates count primes of bits bits and appends them to the pool in dir. The search is seeded
+// from getrandom() rather than the global state, so separate fills do not repeat each other's
+// primes. Appending takes the lock briefly and does not read the pool.
+//
+// Returns the number of primes added, which is less than count only on an I/O error or if the
+// kernel has no randomness to give.
+//
+// Requires:
+//  dir: existing, writable directory
+//  iters: Miller-Rabin iterations (see make_prime)
+//  test: primality test (see PrimeTest)
+//  threads: worker threads per prime, 1 for the sequential search
+//
+uint64_t pool_fill(const char *dir, uint64_t bits, uint64_t count, uint64_t iters, PrimeTest test,
+    uint32_t threads);
+
+//
+// Removes one prime of bits bits from the pool in dir and stores it in p.
+//
+// Returns false, leaving p untouched, if the pool is empty or missing.
+//
+bool pool_take(const char *dir, uint64_t bits, mpz_t p);
+
+//
+// Removes two primes p and q of bits bits from the pool in dir under one lock: p is the last
+// one and q the first before it for which usable(p, q) holds. Primes rejected by usable are
+// removed with them.
+//
+// Returns false, leaving the pool untouched, if no usable pair is left.
+//
+bool pool_take_pair(const char *dir, uint64_t bits, mpz_t p, mpz_t q,
+    bool (*usable)(const mpz_t p, const mpz_t q));
+
+//
+// Returns the number of primes of bits bits left in the pool in dir.
+//
+uint64_t pool_count(const char *dir, uint64_t bits);
@@ -14,3 +14,12 @@ void randstate_init(uint64_t seed) {
 void randstate_clear(void) {
     gmp_randclear(state);
 }
+
+void randstate_init_rs(gmp_randstate_t rs, uint64_t seed) {
+    gmp_randinit_mt(rs);
+    gmp_randseed_ui(rs, seed);
+}
+
+void randstate_clear_rs(gmp_randstate_t rs) {
+    gmp_randclear(rs);
+}
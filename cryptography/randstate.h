@@ -19,3 +19,17 @@ void randstate_init(uint64_t seed);
 // Must be called after all key generation or number theory operations are used.
 //
 void randstate_clear(void);
+
+//
+// Initializes a caller-owned random state, independent of the global one, so that each thread
+// can draw from its own stream. Pass it explicitly to the *_ws number theory functions.
+//
+// rs: the random state to initialize.
+// seed: the seed to seed it with.
+//
+void randstate_init_rs(gmp_randstate_t rs, uint64_t seed);
+
+//
+// Frees any memory used by a random state from randstate_init_rs().
+//
+void randstate_clear_rs(gmp_randstate_t rs);
@@ -1,10 +1,20 @@
 #include <stdio.h>
 #include <gmp.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/random.h>
+#include <unistd.h>
 #include "randstate.h"
 #include "numtheory.h"
+#include "ss.h"
+#include "pool.h"
+#include "chacha.h"
+#include "stats.h"
+#include "lz78.h"
 
 //
 // Generates the components for a new SS key.
@@ -46,6 +56,7 @@ void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters) {
     mpz_mod(q_remainder, q, p_1);
 
     while ((mpz_cmp_ui(p_remainder, 0) == 0) && (mpz_cmp_ui(q_remainder, 0) == 0)) {
+        STAT_ADD(STAT_REGENERATIONS, 1);
         make_prime(p, p_bits, iters);
         make_prime(q, p_bits, iters);
         // compute p-1
@@ -65,6 +76,141 @@ void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters) {
     mpz_mul(n, n, q); // n = p * p * q
 }
 
+// Arguments for searching one prime on its own thread.
+typedef struct PrimeJob {
+    mpz_ptr prime;
+    uint64_t bits, iters, seed;
+    PrimeTest test;
+    uint32_t threads;
+} PrimeJob;
+
+static void *prime_job(void *arg) {
+    PrimeJob *job = (PrimeJob *) arg;
+    make_prime_parallel(job->prime, job->bits, job->iters, job->test, job->threads, job->seed);
+    return NULL;
+}
+
+//
+// Generates the components for a new SS key, searching for p and q at the same time.
+//
+// Provides:
+//  p:  first prime
+//  q: second prime
+//  n: public modulus/exponent
+//
+// Requires:
+//  nbits: minimum # of bits in n
+//  iters: iterations of Miller-Rabin to use for primality check
+//  threads: worker threads per prime
+//  all mpz_t arguments to be initialized
+//  randstate_init() to have been called
+//
+void ss_make_pub_parallel(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters,
+    PrimeTest test, uint32_t threads) {
+    uint64_t p_range = ((2 * nbits) / 5) - (nbits / 5) + 1;
+    uint64_t p_bits = (uint64_t) (random() % p_range) + (nbits / 5);
+
+    // Every search gets its own seed drawn from the seeded global state, so a given -s seed
+    // and thread count always produce the same key.
+    uint64_t seed = gmp_urandomb_ui(state, 32);
+    seed = (seed << 32) | gmp_urandomb_ui(state, 32);
+
+    mpz_t p_1, q_1, p_remainder, q_remainder;
+    mpz_inits(p_1, q_1, p_remainder, q_remainder, NULL);
+
+    for (uint64_t round = 0;; round++) {
+        PrimeJob jobs[2] = {
+            { p, p_bits, iters, derive_seed(seed, 2 * round), test, threads },
+            { q, p_bits, iters, derive_seed(seed, 2 * round + 1), test, threads },
+        };
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, prime_job, &jobs[1]) != 0) {
+            perror("Failed to start prime search");
+            exit(EXIT_FAILURE);
+        }
+        prime_job(&jobs[0]);
+        pthread_join(tid, NULL);
+
+        // same divisibility check as ss_make_pub()
+        mpz_sub_ui(p_1, p, 1);
+        mpz_sub_ui(q_1, q, 1);
+        mpz_mod(p_remainder, p, q_1);
+        mpz_mod(q_remainder, q, p_1);
+        if (!((mpz_cmp_ui(p_remainder, 0) == 0) && (mpz_cmp_ui(q_remainder, 0) == 0))) {
+            break;
+        }
+        STAT_ADD(STAT_REGENERATIONS, 1);
+    }
+    mpz_clears(p_1, q_1, p_remainder, q_remainder, NULL);
+    mpz_mul(n, p, p); // n = p * p
+    mpz_mul(n, n, q); // n = p * p * q
+}
+
+void ss_make_pub_ws(NTWorkspace *w, mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters,
+    gmp_randstate_t rs) {
+    uint64_t p_range = ((2 * nbits) / 5) - (nbits / 5) + 1;
+    uint64_t p_bits = gmp_urandomm_ui(rs, p_range) + (nbits / 5);
+
+    mpz_t p_1, q_1, p_remainder, q_remainder;
+    mpz_inits(p_1, q_1, p_remainder, q_remainder, NULL);
+    for (;;) {
+        make_prime_ws(w, p, p_bits, iters, rs);
+        make_prime_ws(w, q, p_bits, iters, rs);
+
+        // same divisibility check as ss_make_pub()
+        mpz_sub_ui(p_1, p, 1);
+        mpz_sub_ui(q_1, q, 1);
+        mpz_mod(p_remainder, p, q_1);
+        mpz_mod(q_remainder, q, p_1);
+        if (!((mpz_cmp_ui(p_remainder, 0) == 0) && (mpz_cmp_ui(q_remainder, 0) == 0))) {
+            break;
+        }
+        STAT_ADD(STAT_REGENERATIONS, 1);
+    }
+    mpz_clears(p_1, q_1, p_remainder, q_remainder, NULL);
+    mpz_mul(n, p, p); // n = p * p
+    mpz_mul(n, n, q); // n = p * p * q
+}
+
+// True if q may be paired with p: the same divisibility check as ss_make_pub(), and p != q.
+static bool pooled_pair_ok(const mpz_t p, const mpz_t q) {
+    mpz_t p_1, q_1, p_remainder, q_remainder;
+    mpz_inits(p_1, q_1, p_remainder, q_remainder, NULL);
+    mpz_sub_ui(p_1, p, 1);
+    mpz_sub_ui(q_1, q, 1);
+    mpz_mod(p_remainder, p, q_1);
+    mpz_mod(q_remainder, q, p_1);
+    bool ok = mpz_cmp(p, q) != 0
+              && !((mpz_cmp_ui(p_remainder, 0) == 0) && (mpz_cmp_ui(q_remainder, 0) == 0));
+    mpz_clears(p_1, q_1, p_remainder, q_remainder, NULL);
+    STAT_ADD(STAT_REGENERATIONS, !ok);
+    return ok;
+}
+
+//
+// Generates the components for a new SS key from primes in a pool made by pool_fill().
+//
+// Provides:
+//  p:  first prime
+//  q: second prime
+//  n: public modulus/exponent
+//
+// Returns false, leaving the pool untouched, if it holds no usable pair.
+//
+// Requires:
+//  nbits: minimum # of bits in n
+//  dir: pool directory
+//  all mpz_t arguments to be initialized
+//
+bool ss_make_pub_pooled(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, const char *dir) {
+    if (!pool_take_pair(dir, pool_bits(nbits), p, q, pooled_pair_ok)) {
+        return false;
+    }
+    mpz_mul(n, p, p); // n = p * p
+    mpz_mul(n, n, q); // n = p * p * q
+    return true;
+}
+
 //
 // Generates components for a new SS private key.
 //
@@ -195,52 +341,13 @@ void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n) {
 //
 
 void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
-
-    // Calculate the block size
-
-    mpz_t root;
-    mpz_init(root);
-
-    // Compute the integer square root of n and store the result in root
-    mpz_sqrt(root, n);
-
-    // Compute the base-2 logarithm of the square root of root
-    int k = (mpz_sizeinbase(root, 2) - 1) / 8;
-
-    // Divide the result by 8
-
-    // Allocate memory for the block
-    uint8_t *block = (uint8_t *) malloc(k * sizeof(uint8_t));
-    if (block == NULL) {
-        perror("Failed to allocate memory for block");
+    SSKeyCtx *ctx = ss_encrypt_ctx_create(n);
+    if (ctx == NULL) {
+        perror("Failed to allocate memory for key context");
         exit(EXIT_FAILURE);
     }
-
-    // Set the first byte of the block to 0xFF
-    block[0] = 0xFF;
-    mpz_t m, c;
-    mpz_inits(m, c, NULL);
-
-    size_t j;
-    while ((j = fread(block + 1, sizeof(uint8_t), k - 1, infile)) > 0) {
-        // Convert the block to an mpz_t
-
-        mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, block);
-
-        // Encrypt the block
-
-        ss_encrypt(c, m, n);
-
-        // Write the encrypted block to the output file
-        gmp_fprintf(outfile, "%Zx\n", c);
-
-        // Free the memory for the mpz_t variables
-    }
-
-    // Free the memory for the block
-    mpz_clear(root);
-    mpz_clears(m, c, NULL);
-    free(block);
+    ss_encrypt_file_ctx(infile, outfile, ctx);
+    ss_ctx_delete(ctx);
 }
 
 //
@@ -264,7 +371,8 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq) {
 // Decrypt a file back into its original form.
 //
 // Provides:
-//  fills outfile with the unencrypted data from infile
+//  fills outfile with the unencrypted data from infile; false at the first line that is not
+//  a hex number or does not decrypt to a block of this key
 //
 // Requires:
 //  infile: open and readable file stream to encrypted data
@@ -273,37 +381,621 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq) {
 //  pq: private modulus
 //
 
-void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq) {
+bool ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq) {
+    SSKeyCtx *ctx = ss_decrypt_ctx_create(d, pq);
+    if (ctx == NULL) {
+        perror("Failed to allocate memory for key context");
+        exit(EXIT_FAILURE);
+    }
+    bool ok = ss_decrypt_file_ctx(infile, outfile, ctx);
+    ss_ctx_delete(ctx);
+    return ok;
+}
 
-    // Calculate the block size
-    uint64_t k = (mpz_sizeinbase(pq, 2) - 1) / 8;
-    size_t j;
+// Shared setup for both context kinds: block size k, block buffer and scratch.
+static SSKeyCtx *ss_ctx_create(const mpz_t d, const mpz_t mod, uint64_t k) {
+    SSKeyCtx *ctx = (SSKeyCtx *) malloc(sizeof(SSKeyCtx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    ctx->k = k;
+    ctx->pm = pow_mod_ctx_create(d, mod);
+    ctx->block = (uint8_t *) malloc((k + 1) * sizeof(uint8_t));
+    if (ctx->pm == NULL || ctx->block == NULL) {
+        pow_mod_ctx_delete(ctx->pm);
+        free(ctx->block);
+        free(ctx);
+        return NULL;
+    }
+    mpz_init2(ctx->m, 8 * (k + 2));
+    mpz_init2(ctx->c, mpz_sizeinbase(mod, 2) + GMP_NUMB_BITS);
+    return ctx;
+}
 
-    // Allocate memory for the block
-    uint8_t *block = (uint8_t *) malloc(k * sizeof(uint8_t));
-    if (block == NULL) {
-        perror("Failed to allocate memory for block");
-        exit(EXIT_FAILURE);
+SSKeyCtx *ss_encrypt_ctx_create(const mpz_t n) {
+    // Calculate the block size: k = (log2(sqrt(n)) - 1) / 8
+    mpz_t root;
+    mpz_init(root);
+    mpz_sqrt(root, n);
+    uint64_t k = (mpz_sizeinbase(root, 2) - 1) / 8;
+    mpz_clear(root);
+
+    return ss_ctx_create(n, n, k);
+}
+
+SSKeyCtx *ss_decrypt_ctx_create(const mpz_t d, const mpz_t pq) {
+    return ss_ctx_create(d, pq, (mpz_sizeinbase(pq, 2) - 1) / 8);
+}
+
+void ss_ctx_delete(SSKeyCtx *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    pow_mod_ctx_delete(ctx->pm);
+    mpz_clears(ctx->m, ctx->c, NULL);
+    free(ctx->block);
+    free(ctx);
+}
+
+static void put_be64(uint8_t *b, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        b[i] = v & 0xFF;
+        v >>= 8;
     }
+}
 
-    // Read in encrypted blocks and decrypt them
+static uint64_t get_be64(const uint8_t *b) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | b[i];
+    }
+    return v;
+}
 
+// Appends one index record. Returns false if the write failed.
+static bool index_put(FILE *index, uint64_t plain, uint64_t cipher) {
+    uint8_t rec[SS_INDEX_RECORD];
+    put_be64(rec, plain);
+    put_be64(rec + 8, cipher);
+    return fwrite(rec, 1, SS_INDEX_RECORD, index) == SS_INDEX_RECORD;
+}
+
+// Reads record i of index. Returns false if it does not exist.
+static bool index_get(FILE *index, uint64_t i, uint64_t *plain, uint64_t *cipher) {
+    uint8_t rec[SS_INDEX_RECORD];
+    if (fseek(index, sizeof(SS_INDEX_MAGIC) - 1 + i * SS_INDEX_RECORD, SEEK_SET) != 0
+        || fread(rec, 1, SS_INDEX_RECORD, index) != SS_INDEX_RECORD) {
+        return false;
+    }
+    *plain = get_be64(rec);
+    *cipher = get_be64(rec + 8);
+    return true;
+}
+
+// Shared by the plain and indexed file encryption; index may be NULL.
+static bool encrypt_blocks(FILE *infile, FILE *outfile, FILE *index, SSKeyCtx *ctx) {
+    uint8_t *block = ctx->block;
+    uint64_t plain = 0, cipher = 0;
+    bool ok = index == NULL || fwrite(SS_INDEX_MAGIC, 1, sizeof(SS_INDEX_MAGIC) - 1, index)
+                                   == sizeof(SS_INDEX_MAGIC) - 1;
+
+    // Set the first byte of the block to 0xFF
     block[0] = 0xFF;
-    mpz_t c, m;
-    mpz_inits(c, m, NULL);
-    while (gmp_fscanf(infile, "%Zx \n", c) != -1) {
 
-        ss_decrypt(m, c, d, pq);
+    size_t j;
+    STAT_TIMER(t);
+    while ((j = fread(block + 1, sizeof(uint8_t), ctx->k - 1, infile)) > 0) {
+        STAT_LAP(STAT_IO_NS, t);
+
+        // Convert the block to an mpz_t and encrypt it
+        mpz_import(ctx->m, j + 1, 1, sizeof(uint8_t), 1, 0, block);
+        pow_mod_cached(ctx->c, ctx->m, ctx->pm);
+        STAT_LAP(STAT_BLOCK_NS, t);
+        STAT_ADD(STAT_BLOCKS, 1);
+
+        // Write the encrypted block to the output file
+        if (index != NULL) {
+            ok = ok && index_put(index, plain, cipher);
+            plain += j;
+        }
+        cipher += gmp_fprintf(outfile, "%Zx\n", ctx->c);
+        STAT_LAP(STAT_IO_NS, t);
+    }
+    // closing record: total plaintext and ciphertext length
+    return index == NULL || (ok && index_put(index, plain, cipher) && fflush(index) == 0);
+}
+
+void ss_encrypt_file_ctx(FILE *infile, FILE *outfile, SSKeyCtx *ctx) {
+    encrypt_blocks(infile, outfile, NULL, ctx);
+}
+
+bool ss_encrypt_file_indexed(FILE *infile, FILE *outfile, FILE *index, SSKeyCtx *ctx) {
+    return encrypt_blocks(infile, outfile, index, ctx);
+}
+
+bool ss_decrypt_range(
+    FILE *infile, FILE *index, FILE *outfile, SSKeyCtx *ctx, uint64_t start, uint64_t len) {
+    char magic[sizeof(SS_INDEX_MAGIC) - 1];
+    if (fseek(index, 0, SEEK_END) != 0) {
+        return false;
+    }
+    long size = ftell(index);
+    rewind(index);
+    if (size < (long) sizeof(magic) || fread(magic, 1, sizeof(magic), index) != sizeof(magic)
+        || memcmp(magic, SS_INDEX_MAGIC, sizeof(magic)) != 0
+        || (size - sizeof(magic)) % SS_INDEX_RECORD != 0 || size == (long) sizeof(magic)) {
+        return false;
+    }
+    uint64_t blocks = (size - sizeof(magic)) / SS_INDEX_RECORD - 1;
+
+    // the closing record has to describe this ciphertext
+    uint64_t total, cipher_len;
+    if (!index_get(index, blocks, &total, &cipher_len) || fseek(infile, 0, SEEK_END) != 0
+        || (uint64_t) ftell(infile) != cipher_len) {
+        return false;
+    }
+    if (start >= total || len == 0) {
+        return true;
+    }
+    uint64_t end = len > total - start ? total : start + len;
+
+    // last block starting at or before start
+    uint64_t lo = 0, hi = blocks - 1;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo + 1) / 2;
+        uint64_t plain, cipher;
+        if (!index_get(index, mid, &plain, &cipher)) {
+            return false;
+        }
+        if (plain <= start) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    uint8_t *block = ctx->block;
+    uint64_t plain, cipher, next_plain, next_cipher;
+    if (!index_get(index, lo, &plain, &cipher)) {
+        return false;
+    }
+    for (uint64_t i = lo; i < blocks && plain < end; i++) {
+        if (!index_get(index, i + 1, &next_plain, &next_cipher) || next_plain <= plain
+            || next_plain - plain > ctx->k - 1 || fseek(infile, cipher, SEEK_SET) != 0
+            || gmp_fscanf(infile, "%Zx", ctx->c) != 1) {
+            return false;
+        }
+        pow_mod_cached(ctx->m, ctx->c, ctx->pm);
+        STAT_ADD(STAT_BLOCKS, 1);
+
+        // a block that does not decrypt to its indexed length means the wrong key or index
+        size_t j;
+        mpz_export(block, &j, 1, sizeof(uint8_t), 1, 0, ctx->m);
+        if (j != next_plain - plain + 1) {
+            return false;
+        }
+        uint64_t from = start > plain ? start - plain : 0;
+        uint64_t to = end < next_plain ? end - plain : next_plain - plain;
+        fwrite(block + 1 + from, sizeof(uint8_t), to - from, outfile);
+
+        plain = next_plain;
+        cipher = next_cipher;
+    }
+    return true;
+}
 
-        // Export the decrypted block to a byte array
+bool ss_decrypt_file_ctx(FILE *infile, FILE *outfile, SSKeyCtx *ctx) {
+    uint8_t *block = ctx->block;
+    size_t j;
 
-        mpz_export(block, &j, 1, sizeof(uint8_t), 1, 0, m);
+    // Read in encrypted blocks and decrypt them
+    STAT_TIMER(t);
+    int scanned;
+    while ((scanned = gmp_fscanf(infile, "%Zx \n", ctx->c)) == 1) {
+        STAT_LAP(STAT_IO_NS, t);
+        pow_mod_cached(ctx->m, ctx->c, ctx->pm);
+
+        // Export the decrypted block to a byte array; a block made with this key has its 0xFF
+        // pad byte and fits the buffer, anything else is not our ciphertext
+        if ((mpz_sizeinbase(ctx->m, 2) + 7) / 8 > ctx->k + 1) {
+            return false;
+        }
+        mpz_export(block, &j, 1, sizeof(uint8_t), 1, 0, ctx->m);
+        if (j < 1) {
+            return false;
+        }
+        STAT_LAP(STAT_BLOCK_NS, t);
+        STAT_ADD(STAT_BLOCKS, 1);
 
         // Write the decrypted block to the output file
         fwrite(block + 1, sizeof(uint8_t), j - 1, outfile);
+        STAT_LAP(STAT_IO_NS, t);
+    }
+    return scanned == EOF; // anything but a hex number before the end is malformed
+}
+
+size_t ss_encrypt_bound(const SSKeyCtx *ctx, size_t len) {
+    if (ctx->k < 2) {
+        return 0; // key too small to carry any payload
+    }
+    // one line per block, at most as many hex digits as the modulus plus a newline
+    size_t blocks = (len + ctx->k - 2) / (ctx->k - 1);
+    return blocks * (mpz_sizeinbase(ctx->pm->n, 16) + 1);
+}
+
+size_t ss_decrypt_bound(const SSKeyCtx *ctx, size_t len) {
+    // every line is at least a digit and a newline, and decrypts to at most k bytes
+    return ((len + 1) / 2) * ctx->k;
+}
+
+bool ss_encrypt_buf(
+    SSKeyCtx *ctx, const uint8_t *in, size_t len, uint8_t *out, size_t cap, size_t *outlen) {
+    uint8_t *block = ctx->block;
+    block[0] = 0xFF;
+    if (ctx->k < 2) {
+        return false; // key too small to carry any payload
+    }
+
+    size_t pos = 0;
+    for (size_t off = 0; off < len; off += ctx->k - 1) {
+        size_t j = len - off < ctx->k - 1 ? len - off : ctx->k - 1;
+        memcpy(block + 1, in + off, j);
+        mpz_import(ctx->m, j + 1, 1, sizeof(uint8_t), 1, 0, block);
+        pow_mod_cached(ctx->c, ctx->m, ctx->pm);
+        STAT_ADD(STAT_BLOCKS, 1);
+
+        // exact for base 16; mpz_get_str also writes a NUL where the newline goes
+        size_t digits = mpz_sizeinbase(ctx->c, 16);
+        if (pos + digits + 1 > cap) {
+            return false;
+        }
+        mpz_get_str((char *) out + pos, 16, ctx->c);
+        out[pos + digits] = '\n';
+        pos += digits + 1;
+    }
+    *outlen = pos;
+    return true;
+}
+
+static bool is_hex(uint8_t ch) {
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+bool ss_decrypt_buf(
+    SSKeyCtx *ctx, const uint8_t *in, size_t len, uint8_t *out, size_t cap, size_t *outlen) {
+    uint8_t *block = ctx->block;
+    char *line = NULL; // NUL-terminated copy of one line for mpz_set_str()
+    size_t line_cap = 0, pos = 0, off = 0;
+    bool ok = true;
+
+    while (ok) {
+        while (off < len && (in[off] == '\n' || in[off] == ' ' || in[off] == '\r')) {
+            off += 1;
+        }
+        if (off == len) {
+            break;
+        }
+        size_t end = off;
+        while (end < len && is_hex(in[end])) {
+            end += 1;
+        }
+        if (end == off || (end < len && in[end] != '\n' && in[end] != ' ' && in[end] != '\r')) {
+            ok = false; // not a hex line
+            break;
+        }
+        if (end - off + 1 > line_cap) {
+            line_cap = 2 * (end - off + 1);
+            char *grown = (char *) realloc(line, line_cap);
+            if (grown == NULL) {
+                ok = false;
+                break;
+            }
+            line = grown;
+        }
+        memcpy(line, in + off, end - off);
+        line[end - off] = '\0';
+        off = end;
+
+        mpz_set_str(ctx->c, line, 16);
+        pow_mod_cached(ctx->m, ctx->c, ctx->pm);
+        STAT_ADD(STAT_BLOCKS, 1);
+        size_t j = 0;
+        if ((mpz_sizeinbase(ctx->m, 2) + 7) / 8 > ctx->k + 1) {
+            ok = false; // only possible when the ciphertext is not below the modulus
+            break;
+        }
+        mpz_export(block, &j, 1, sizeof(uint8_t), 1, 0, ctx->m);
+        if (j < 1 || pos + j - 1 > cap) {
+            ok = false; // not a block of this key (as in ss_decrypt_file_ctx), or out is full
+            break;
+        }
+        memcpy(out + pos, block + 1, j - 1);
+        pos += j - 1;
+    }
+    free(line);
+    *outlen = pos;
+    return ok;
+}
+
+// Messages one batch thread handles: every stride-th one starting at first.
+typedef struct BatchJob {
+    mpz_ptr n, d, pq; // n for encryption, d and pq for decryption
+    SSMessage *msgs;
+    size_t count, first, stride;
+    size_t done;
+} BatchJob;
+
+static void *batch_job(void *arg) {
+    BatchJob *job = (BatchJob *) arg;
+    bool encrypt = job->n != NULL;
+    SSKeyCtx *ctx = encrypt ? ss_encrypt_ctx_create(job->n) : ss_decrypt_ctx_create(job->d, job->pq);
+    job->done = 0;
+    for (size_t i = job->first; i < job->count; i += job->stride) {
+        SSMessage *msg = &job->msgs[i];
+        msg->outlen = 0;
+        msg->ok = ctx != NULL
+                  && (encrypt ? ss_encrypt_buf(ctx, msg->in, msg->len, msg->out, msg->cap,
+                                    &msg->outlen)
+                              : ss_decrypt_buf(ctx, msg->in, msg->len, msg->out, msg->cap,
+                                    &msg->outlen));
+        job->done += msg->ok;
+    }
+    ss_ctx_delete(ctx);
+    return NULL;
+}
+
+static size_t batch_run(BatchJob *proto, SSMessage *msgs, size_t count, uint32_t threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > count) {
+        threads = count > 0 ? count : 1;
+    }
+    BatchJob *jobs = (BatchJob *) malloc(threads * sizeof(BatchJob));
+    pthread_t *tids = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    if (jobs == NULL || tids == NULL) {
+        perror("Failed to allocate batch");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+        memcpy(&jobs[t], proto, sizeof(BatchJob));
+        jobs[t].msgs = msgs;
+        jobs[t].count = count;
+        jobs[t].first = t;
+        jobs[t].stride = threads;
+        if (t > 0 && pthread_create(&tids[t], NULL, batch_job, &jobs[t]) != 0) {
+            perror("Failed to start batch thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    batch_job(&jobs[0]); // the calling thread takes the first share
+    size_t done = jobs[0].done;
+    for (uint32_t t = 1; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        done += jobs[t].done;
+    }
+    free(jobs);
+    free(tids);
+    return done;
+}
+
+size_t ss_encrypt_batch(const mpz_t n, SSMessage *msgs, size_t count, uint32_t threads) {
+    BatchJob proto = { .n = (mpz_ptr) n };
+    return batch_run(&proto, msgs, count, threads);
+}
+
+size_t ss_decrypt_batch(
+    const mpz_t d, const mpz_t pq, SSMessage *msgs, size_t count, uint32_t threads) {
+    BatchJob proto = { .d = (mpz_ptr) d, .pq = (mpz_ptr) pq };
+    return batch_run(&proto, msgs, count, threads);
+}
+
+// Chunk nonce: 4 zero bytes, then the chunk number as 8 big-endian bytes.
+static void hybrid_nonce(uint8_t nonce[AEAD_NONCE_BYTES], uint64_t chunk) {
+    memset(nonce, 0, AEAD_NONCE_BYTES);
+    for (int i = 0; i < 8; i++) {
+        nonce[AEAD_NONCE_BYTES - 1 - i] = (chunk >> (8 * i)) & 0xFF;
+    }
+}
+
+bool ss_encrypt_file_hybrid(FILE *infile, FILE *outfile, SSKeyCtx *ctx) {
+    uint8_t key[AEAD_KEY_BYTES];
+    if (ctx->k < 2 || getrandom(key, sizeof(key), 0) != (ssize_t) sizeof(key)) {
+        return false;
+    }
+
+    // Session key, blocked and SS-encrypted exactly like ss_encrypt_file does
+    uint64_t per_block = ctx->k - 1;
+    uint64_t blocks = (sizeof(key) + per_block - 1) / per_block;
+    fprintf(outfile, "%s %" PRIu64 "\n", SS_HYBRID_MAGIC, blocks);
+    ctx->block[0] = 0xFF;
+    for (uint64_t off = 0; off < sizeof(key); off += per_block) {
+        uint64_t j = sizeof(key) - off < per_block ? sizeof(key) - off : per_block;
+        memcpy(ctx->block + 1, key + off, j);
+        mpz_import(ctx->m, j + 1, 1, sizeof(uint8_t), 1, 0, ctx->block);
+        pow_mod_cached(ctx->c, ctx->m, ctx->pm);
+        gmp_fprintf(outfile, "%Zx\n", ctx->c);
+    }
+
+    uint8_t *buf = (uint8_t *) malloc(SS_HYBRID_CHUNK);
+    if (buf == NULL) {
+        perror("Failed to allocate memory for chunk");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t header[4], tag[AEAD_TAG_BYTES], nonce[AEAD_NONCE_BYTES];
+    for (uint64_t chunk = 0;; chunk++) {
+        size_t len = fread(buf, sizeof(uint8_t), SS_HYBRID_CHUNK, infile);
+        int next = fgetc(infile);
+        bool last = next == EOF;
+        if (!last) {
+            ungetc(next, infile);
+        }
+
+        uint32_t word = (uint32_t) len | (last ? 0x80000000u : 0);
+        for (int i = 0; i < 4; i++) {
+            header[i] = (word >> (24 - 8 * i)) & 0xFF;
+        }
+        hybrid_nonce(nonce, chunk);
+        aead_encrypt(buf, tag, buf, len, header, sizeof(header), key, nonce);
+        fwrite(header, sizeof(uint8_t), sizeof(header), outfile);
+        fwrite(buf, sizeof(uint8_t), len, outfile);
+        fwrite(tag, sizeof(uint8_t), sizeof(tag), outfile);
+        if (last) {
+            break;
+        }
+    }
+
+    memset(key, 0, sizeof(key));
+    free(buf);
+    return true;
+}
+
+bool ss_decrypt_file_hybrid(FILE *infile, FILE *outfile, SSKeyCtx *ctx) {
+    char *line = NULL;
+    size_t cap = 0;
+    uint64_t blocks = 0;
+    if (getline(&line, &cap, infile) < 0
+        || sscanf(line, SS_HYBRID_MAGIC " %" SCNu64, &blocks) != 1 || blocks > AEAD_KEY_BYTES) {
+        free(line);
+        return false;
+    }
+
+    // Recover the session key from its SS-encrypted blocks
+    uint8_t key[AEAD_KEY_BYTES];
+    size_t have = 0;
+    bool ok = true;
+    for (uint64_t b = 0; b < blocks && ok; b++) {
+        size_t j = 0;
+        ok = getline(&line, &cap, infile) > 0 && mpz_set_str(ctx->c, line, 16) == 0;
+        if (ok) {
+            pow_mod_cached(ctx->m, ctx->c, ctx->pm);
+            ok = (mpz_sizeinbase(ctx->m, 2) + 7) / 8 <= ctx->k + 1; // fits the block buffer
+        }
+        if (ok) {
+            mpz_export(ctx->block, &j, 1, sizeof(uint8_t), 1, 0, ctx->m);
+            ok = j >= 1 && have + j - 1 <= sizeof(key);
+        }
+        if (ok) {
+            memcpy(key + have, ctx->block + 1, j - 1);
+            have += j - 1;
+        }
+    }
+    free(line);
+    if (!ok || have != sizeof(key)) {
+        return false;
+    }
+
+    uint8_t *buf = (uint8_t *) malloc(SS_HYBRID_CHUNK);
+    if (buf == NULL) {
+        perror("Failed to allocate memory for chunk");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t header[4], tag[AEAD_TAG_BYTES], nonce[AEAD_NONCE_BYTES];
+    ok = false;
+    for (uint64_t chunk = 0;; chunk++) {
+        if (fread(header, sizeof(uint8_t), sizeof(header), infile) != sizeof(header)) {
+            break; // truncated before the last chunk
+        }
+        uint32_t word = ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16)
+                        | ((uint32_t) header[2] << 8) | header[3];
+        bool last = (word & 0x80000000u) != 0;
+        size_t len = word & 0x7FFFFFFFu;
+        if (len > SS_HYBRID_CHUNK || fread(buf, sizeof(uint8_t), len, infile) != len
+            || fread(tag, sizeof(uint8_t), sizeof(tag), infile) != sizeof(tag)) {
+            break;
+        }
+        hybrid_nonce(nonce, chunk);
+        if (!aead_decrypt(buf, buf, len, tag, header, sizeof(header), key, nonce)) {
+            break;
+        }
+        fwrite(buf, sizeof(uint8_t), len, outfile);
+        if (last) {
+            ok = true;
+            break;
+        }
+    }
+
+    memset(key, 0, sizeof(key));
+    free(buf);
+    return ok;
+}
+
+bool ss_is_hybrid(FILE *infile) {
+    int first = fgetc(infile);
+    if (first != EOF) {
+        ungetc(first, infile);
+    }
+    return first == SS_HYBRID_MAGIC[0];
+}
+
+static void *lz78_compress_job(void *arg) {
+    SSLz78 *z = (SSLz78 *) arg;
+    lz78_encode(z->in, z->out);
+    close(z->out);
+    z->ok = true;
+    return NULL;
+}
+
+static void *lz78_decompress_job(void *arg) {
+    SSLz78 *z = (SSLz78 *) arg;
+    z->ok = lz78_decode(z->in, z->out);
+
+    // Drain whatever follows a bad stream so the writer never sees a broken pipe
+    uint8_t sink[4096];
+    while (read(z->in, sink, sizeof(sink)) > 0) {
+    }
+    close(z->in);
+    return NULL;
+}
+
+// Connects a pipe to the helper thread; the caller gets the read end when compressing and the
+// write end when decompressing.
+static FILE *lz78_start(SSLz78 *z, int fd, bool compress) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("Failed to create pipe");
+        exit(EXIT_FAILURE);
+    }
+    z->ok = false;
+    z->in = compress ? fd : fds[0];
+    z->out = compress ? fds[1] : fd;
+    z->stream = compress ? fdopen(fds[0], "r") : fdopen(fds[1], "w");
+    if (z->stream == NULL
+        || pthread_create(
+               &z->tid, NULL, compress ? lz78_compress_job : lz78_decompress_job, z)
+               != 0) {
+        perror("Failed to start compression");
+        exit(EXIT_FAILURE);
+    }
+    return z->stream;
+}
+
+FILE *ss_lz78_compress(FILE *infile, SSLz78 *z) {
+    return lz78_start(z, fileno(infile), true);
+}
+
+FILE *ss_lz78_decompress(FILE *outfile, SSLz78 *z) {
+    fflush(outfile); // the helper writes to the descriptor directly
+    return lz78_start(z, fileno(outfile), false);
+}
+
+bool ss_lz78_finish(SSLz78 *z) {
+    fclose(z->stream);
+    pthread_join(z->tid, NULL);
+    return z->ok;
+}
+
+bool ss_is_compressed(FILE *infile) {
+    int first = fgetc(infile);
+    if (first != EOF) {
+        ungetc(first, infile);
+    }
+    if (first != SS_LZ78_MAGIC[0]) {
+        return false;
     }
-    // Free the memory for the mpz_t variables
-    mpz_clears(c, m, NULL);
-    // Free the memory for the block and hexstring
-    free(block);
+    char line[sizeof(SS_LZ78_MAGIC) + 1];
+    return fgets(line, sizeof(line), infile) != NULL
+           && strcmp(line, SS_LZ78_MAGIC "\n") == 0;
 }
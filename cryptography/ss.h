@@ -4,6 +4,8 @@
 #include <gmp.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+#include "numtheory.h"
 
 //
 // Generates the components for a new SS key.
@@ -20,6 +22,56 @@
 //
 void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters);
 
+//
+// Generates the components for a new SS key, searching for p and q at the same time.
+//
+// Provides:
+//  p:  first prime
+//  q: second prime
+//  n: public modulus/exponent
+//
+// Requires:
+//  nbits: minimum # of bits in n
+//  iters: iterations of Miller-Rabin to use for primality check
+//  test: primality test (see PrimeTest)
+//  threads: worker threads per prime
+//  all mpz_t arguments to be initialized
+//  randstate_init() to have been called
+//
+void ss_make_pub_parallel(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters,
+    PrimeTest test, uint32_t threads);
+
+//
+// Reentrant version of ss_make_pub(): the prime size and both primes come from the caller-owned
+// rs, with w as scratch, so any number of threads can generate keys at once and the key depends
+// only on how rs was seeded. The primes are tested with w->test.
+//
+// Requires:
+//  w: workspace from nt_workspace_init()
+//  rs: random state from randstate_init_rs()
+//  all mpz_t arguments to be initialized
+//
+void ss_make_pub_ws(NTWorkspace *w, mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters,
+    gmp_randstate_t rs);
+
+//
+// Generates the components for a new SS key from primes in a pool made by pool_fill().
+// Drawn primes are consumed even when the pair is rejected.
+//
+// Provides:
+//  p:  first prime
+//  q: second prime
+//  n: public modulus/exponent
+//
+// Returns false if the pool ran out before a usable pair was drawn.
+//
+// Requires:
+//  nbits: minimum # of bits in n
+//  dir: pool directory
+//  all mpz_t arguments to be initialized
+//
+bool ss_make_pub_pooled(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, const char *dir);
+
 //
 // Generates components for a new SS private key.
 //
@@ -125,7 +177,8 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq);
 // Decrypt a file back into its original form.
 //
 // Provides:
-//  fills outfile with the unencrypted data from infile
+//  fills outfile with the unencrypted data from infile; false at the first line that is not
+//  a hex number or does not decrypt to a block of this key
 //
 // Requires:
 //  infile: open and readable file stream to encrypted data
@@ -133,4 +186,230 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq);
 //  d: private exponent
 //  pq: private modulus
 //
-void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq);
+bool ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq);
+
+//
+// Per-key state reused across every block and every file encrypted or decrypted with one key.
+// Holds the precomputed exponentiation (see PowModCtx), the block size and the block buffer.
+//
+typedef struct SSKeyCtx {
+    PowModCtx *pm; // exponent recoding, reduction constants and scratch
+    uint64_t k; // block size in bytes
+    uint8_t *block; // block buffer of k + 1 bytes
+    mpz_t m, c; // scratch
+} SSKeyCtx;
+
+//
+// Builds an encryption context for public key n.
+// Returns NULL if memory could not be allocated.
+//
+SSKeyCtx *ss_encrypt_ctx_create(const mpz_t n);
+
+//
+// Builds a decryption context for private key (d, pq).
+// Returns NULL if memory could not be allocated.
+//
+SSKeyCtx *ss_decrypt_ctx_create(const mpz_t d, const mpz_t pq);
+
+//
+// Frees all memory used by ctx.
+//
+void ss_ctx_delete(SSKeyCtx *ctx);
+
+//
+// Encrypt an arbitrary file using a context from ss_encrypt_ctx_create().
+// Output is identical to ss_encrypt_file().
+//
+void ss_encrypt_file_ctx(FILE *infile, FILE *outfile, SSKeyCtx *ctx);
+
+//
+// Decrypt a file using a context from ss_decrypt_ctx_create().
+// Output is identical to ss_decrypt_file(). Returns false, after writing the blocks before it,
+// at the first line that is not a hex number or does not decrypt to a block of this key.
+//
+bool ss_decrypt_file_ctx(FILE *infile, FILE *outfile, SSKeyCtx *ctx);
+
+//
+// Sidecar index for random-access decryption: the "ss-index" magic, then one 16-byte record per
+// block holding its plaintext offset and the offset of its ciphertext line, both 64-bit
+// big-endian, and a closing record with the total plaintext and ciphertext lengths. The
+// ciphertext itself is unchanged.
+//
+#define SS_INDEX_MAGIC  "ss-index"
+#define SS_INDEX_RECORD 16
+
+//
+// Encrypt an arbitrary file and write its index
+//
+// Provides:
+//  fills outfile exactly as ss_encrypt_file_ctx() does, and index with the offsets of each block
+//  returns false if the index could not be written
+//
+// Requires:
+//  index: open and writable file stream
+//  ctx: context from ss_encrypt_ctx_create()
+//
+bool ss_encrypt_file_indexed(FILE *infile, FILE *outfile, FILE *index, SSKeyCtx *ctx);
+
+//
+// Decrypt plaintext bytes [start, start + len) of an indexed file, touching only the blocks that
+// overlap the range
+//
+// Provides:
+//  writes the range to outfile, clipped to the end of the plaintext
+//  returns false if index is malformed, does not describe infile, or a block does not decrypt
+//  to its indexed length (wrong key)
+//
+// Requires:
+//  infile: seekable stream of the ciphertext written alongside index
+//  index: seekable stream of the index from ss_encrypt_file_indexed()
+//  ctx: context from ss_decrypt_ctx_create()
+//
+bool ss_decrypt_range(
+    FILE *infile, FILE *index, FILE *outfile, SSKeyCtx *ctx, uint64_t start, uint64_t len);
+
+//
+// Buffer versions of ss_encrypt_file_ctx() and ss_decrypt_file_ctx(): same blocking (0xFF prefix
+// byte, k - 1 payload bytes per block) and the same hex-line ciphertext, without stdio.
+//
+// Provides:
+//  out: the first *outlen bytes are the result
+//  returns false if out is too small (see the bounds below) or, when decrypting, in has a
+//  line that is not a hex number or does not decrypt to a block of this key
+//
+// Requires:
+//  ctx: context from ss_encrypt_ctx_create() or ss_decrypt_ctx_create() respectively
+//
+bool ss_encrypt_buf(
+    SSKeyCtx *ctx, const uint8_t *in, size_t len, uint8_t *out, size_t cap, size_t *outlen);
+bool ss_decrypt_buf(
+    SSKeyCtx *ctx, const uint8_t *in, size_t len, uint8_t *out, size_t cap, size_t *outlen);
+
+//
+// Output sizes that are always enough for len bytes of input.
+//
+size_t ss_encrypt_bound(const SSKeyCtx *ctx, size_t len);
+size_t ss_decrypt_bound(const SSKeyCtx *ctx, size_t len);
+
+//
+// One message of a batch. The caller sets in, len, out and cap; the batch sets outlen and ok.
+//
+typedef struct SSMessage {
+    const uint8_t *in;
+    size_t len;
+    uint8_t *out;
+    size_t cap;
+    size_t outlen;
+    bool ok;
+} SSMessage;
+
+//
+// Encrypts (or decrypts) every message of a batch with one key, building the per-key context
+// once per thread instead of once per message.
+//
+// Provides:
+//  returns the number of messages with ok set
+//
+// Requires:
+//  n (or d and pq): the key
+//  threads: threads to spread the batch over, 1 to stay on the calling thread
+//
+size_t ss_encrypt_batch(const mpz_t n, SSMessage *msgs, size_t count, uint32_t threads);
+size_t ss_decrypt_batch(
+    const mpz_t d, const mpz_t pq, SSMessage *msgs, size_t count, uint32_t threads);
+
+//
+// Hybrid mode: a random 32-byte session key is SS-encrypted once, and the payload is encrypted
+// with ChaCha20-Poly1305 under that key in independently authenticated chunks.
+//
+// Layout: a "#ss-hybrid <blocks>" line, <blocks> hex lines holding the SS-encrypted session key
+// (blocked like ss_encrypt_file), then binary chunks of a 4-byte big-endian header (length, top
+// bit set on the last chunk), the ciphertext and a 16-byte tag. Chunk i uses nonce i and the
+// header as associated data, so reordering, truncation and tampering are all detected.
+//
+#define SS_HYBRID_MAGIC "#ss-hybrid"
+#define SS_HYBRID_CHUNK 65536
+
+//
+// Encrypt an arbitrary file in hybrid mode
+//
+// Provides:
+//  fills outfile with the hybrid-encrypted contents of infile
+//  returns false if no session key could be generated
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  ctx: context from ss_encrypt_ctx_create()
+//
+bool ss_encrypt_file_hybrid(FILE *infile, FILE *outfile, SSKeyCtx *ctx);
+
+//
+// Decrypt a file written by ss_encrypt_file_hybrid()
+//
+// Provides:
+//  fills outfile with the plaintext of every chunk that authenticated
+//  returns false if the input is malformed, truncated or fails authentication
+//
+// Requires:
+//  infile: open and readable file stream positioned at the "#ss-hybrid" line
+//  outfile: open and writable file stream
+//  ctx: context from ss_decrypt_ctx_create()
+//
+bool ss_decrypt_file_hybrid(FILE *infile, FILE *outfile, SSKeyCtx *ctx);
+
+//
+// Returns true if infile starts with a hybrid-mode header. Consumes nothing.
+//
+bool ss_is_hybrid(FILE *infile);
+
+//
+// Compressed mode: the plaintext is run through the LZ78 codec from ../compression before it is
+// encrypted, in either format, and a "!ss-lz78" line in front of the ciphertext says so. The
+// codec runs on a helper thread connected by a pipe, so neither side holds the whole file.
+//
+#define SS_LZ78_MAGIC "!ss-lz78"
+
+// Helper thread and pipe behind a compressed stream.
+typedef struct SSLz78 {
+    pthread_t tid;
+    FILE *stream;
+    int in, out;
+    bool ok;
+} SSLz78;
+
+//
+// Start compressing infile
+//
+// Provides:
+//  returns a stream of the LZ78-compressed contents of infile
+//
+// Requires:
+//  infile: open and readable file stream that nothing has been read from yet
+//  z: state to pass to ss_lz78_finish() once the returned stream has been read to EOF
+//
+FILE *ss_lz78_compress(FILE *infile, SSLz78 *z);
+
+//
+// Start decompressing into outfile
+//
+// Provides:
+//  returns a writable stream; LZ78 data written to it is decompressed into outfile
+//
+// Requires:
+//  outfile: open and writable file stream, not written to until ss_lz78_finish() returns
+//  z: state to pass to ss_lz78_finish() after the last write
+//
+FILE *ss_lz78_decompress(FILE *outfile, SSLz78 *z);
+
+//
+// Close the stream from ss_lz78_compress() or ss_lz78_decompress() and wait for the helper thread.
+// Returns false if decompression found corrupt or truncated data.
+//
+bool ss_lz78_finish(SSLz78 *z);
+
+//
+// Returns true if infile starts with the compressed-mode marker line, which is then consumed.
+// Consumes nothing unless infile starts with '!', which no other format does.
+//
+bool ss_is_compressed(FILE *infile);
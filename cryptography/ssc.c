@@ -0,0 +1,111 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// header files
+#include "ssclient.h"
+
+#define OPTIONS "hedi:o:S:" //these are our argument options
+
+void print_help(void) { // helper function for printing help
+    fprintf(stderr,
+
+        "SYNOPSIS\n"
+        "   Encrypts or decrypts data through a running ssd daemon.\n"
+        "   Output is the same as encrypt or decrypt with the daemon's keys.\n"
+        "\n"
+        "USAGE\n"
+        "   ./ssc [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -e              Encrypt (default).\n"
+        "   -d              Decrypt.\n"
+        "   -i infile       Input file (default: stdin).\n"
+        "   -o outfile      Output file (default: stdout).\n"
+        "   -S socket       Daemon socket path (default: ss.sock).\n");
+
+    return;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    FILE *input = stdin;
+    FILE *output = stdout;
+    char *path = SSC_SOCKET;
+    uint8_t op = SSC_ENCRYPT;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
+        switch (opt) {
+        case 'h': print_help(); return 0;
+        case 'e': op = SSC_ENCRYPT; break;
+        case 'd': op = SSC_DECRYPT; break;
+        case 'i':
+            input = fopen(optarg, "r");
+            if (input == NULL) {
+                perror("Error opening input file");
+                return 1;
+            }
+            break;
+        case 'o':
+            output = fopen(optarg, "w");
+            if (output == NULL) {
+                perror("Error opening output file");
+                return 1;
+            }
+            break;
+        case 'S': path = optarg; break;
+        default:
+            print_help();
+            return 1;
+            break;
+        }
+    }
+
+    // A request is one frame, so read the whole input first
+    size_t len = 0, cap = 4096;
+    uint8_t *buf = (uint8_t *) malloc(cap);
+    size_t got;
+    while (buf != NULL && (got = fread(buf + len, 1, cap - len, input)) > 0) {
+        len += got;
+        if (len == cap) {
+            cap *= 2;
+            buf = (uint8_t *) realloc(buf, cap);
+        }
+    }
+    if (buf == NULL || len > SSC_MAX_FRAME) {
+        fprintf(stderr, "Input too large.\n");
+        return 1;
+    }
+
+    int fd = ssc_connect(path);
+    if (fd < 0) {
+        perror("Error connecting to daemon");
+        return 1;
+    }
+    uint8_t status;
+    uint32_t outlen;
+    uint8_t *out = ssc_call(fd, op, buf, len, &status, &outlen);
+    if (out == NULL) {
+        fprintf(stderr, "Daemon closed the connection.\n");
+        return 1;
+    }
+    if (status != SSC_OK) {
+        fprintf(stderr, "Daemon error: %s\n", (char *) out);
+        return 1;
+    }
+    fwrite(out, 1, outlen, output);
+
+    close(fd);
+    free(out);
+    free(buf);
+    if (input != stdin) {
+        fclose(input);
+    }
+    if (output != stdout) {
+        fclose(output);
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ssclient.h"
+
+// Loops until all len bytes are written. Returns false on error.
+static bool write_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Loops until all len bytes are read. Returns false on EOF or error.
+static bool read_all(int fd, uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+int ssc_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+bool ssc_send(int fd, uint8_t op, const uint8_t *buf, uint32_t len) {
+    uint8_t header[5] = { op, len >> 24, len >> 16, len >> 8, len };
+    return write_all(fd, header, sizeof(header)) && write_all(fd, buf, len);
+}
+
+uint8_t *ssc_recv(int fd, uint8_t *op, uint32_t *len) {
+    uint8_t header[5];
+    if (!read_all(fd, header, sizeof(header))) {
+        return NULL;
+    }
+    *op = header[0];
+    *len = (uint32_t) header[1] << 24 | (uint32_t) header[2] << 16 | (uint32_t) header[3] << 8
+           | header[4];
+    if (*len > SSC_MAX_FRAME) {
+        return NULL;
+    }
+    uint8_t *buf = (uint8_t *) malloc(*len + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (!read_all(fd, buf, *len)) {
+        free(buf);
+        return NULL;
+    }
+    buf[*len] = '\0';
+    return buf;
+}
+
+uint8_t *ssc_call(int fd, uint8_t op, const uint8_t *in, uint32_t len, uint8_t *status,
+    uint32_t *outlen) {
+    if (!ssc_send(fd, op, in, len)) {
+        return NULL;
+    }
+    return ssc_recv(fd, status, outlen);
+}
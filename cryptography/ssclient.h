@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Framing shared by the ssd daemon and its clients. Every message on the Unix socket is a frame:
+// a 1-byte op, a 4-byte big-endian payload length, then the payload. A connection carries any
+// number of request/response pairs, answered in order.
+//
+// Requests:  SSC_ENCRYPT (payload: plaintext), SSC_DECRYPT (payload: ciphertext as written by
+//            ss_encrypt_file, hex lines)
+// Responses: SSC_OK (payload: result), SSC_ERROR (payload: message)
+//
+#define SSC_ENCRYPT 'E'
+#define SSC_DECRYPT 'D'
+#define SSC_OK      'O'
+#define SSC_ERROR   'X'
+
+#define SSC_SOCKET    "ss.sock" // default socket path
+#define SSC_MAX_FRAME (64u << 20) // longest payload either side accepts
+
+//
+// Connects to the daemon listening on path. Returns the socket, or -1 with errno set.
+//
+int ssc_connect(const char *path);
+
+//
+// Writes one frame. Returns false if the connection failed.
+//
+bool ssc_send(int fd, uint8_t op, const uint8_t *buf, uint32_t len);
+
+//
+// Reads one frame into a malloc()ed buffer of *len bytes (plus a terminating NUL, not counted)
+// and stores its op in *op. Returns NULL on EOF, a connection error or an oversized frame.
+//
+uint8_t *ssc_recv(int fd, uint8_t *op, uint32_t *len);
+
+//
+// Sends one request and waits for its response.
+//
+// Provides:
+//  returns the response payload (free() it), or NULL if the connection failed
+//  *status: SSC_OK or SSC_ERROR
+//  *outlen: payload length
+//
+uint8_t *ssc_call(int fd, uint8_t op, const uint8_t *in, uint32_t len, uint8_t *status,
+    uint32_t *outlen);
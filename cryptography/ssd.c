@@ -0,0 +1,291 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// header files
+#include "numtheory.h"
+#include "ss.h"
+#include "ssclient.h"
+
+#define OPTIONS "hvn:d:S:w:" //these are our argument options
+
+#define QUEUE_SIZE 64 // accepted connections waiting for a worker
+#define IO_TIMEOUT 10 // seconds a connection may hold a worker without sending or reading
+
+bool v_flag = false;
+
+void print_help(void) { // helper function for printing help
+    fprintf(stderr,
+
+        "SYNOPSIS\n"
+        "   Serves SS encryption and decryption over a Unix domain socket.\n"
+        "   Keys are loaded once; each worker keeps its own precomputed key contexts.\n"
+        "\n"
+        "USAGE\n"
+        "   ./ssd [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -v              Log connections to stderr.\n"
+        "   -n pbfile       Public key file, enables encryption (default: ss.pub).\n"
+        "   -d pvfile       Private key file, enables decryption (default: ss.priv).\n"
+        "   -S socket       Socket path (default: ss.sock).\n"
+        "   -w workers      Worker threads, one connection each at a time (default: 4).\n");
+
+    return;
+}
+
+// Accepted connections waiting for a worker.
+typedef struct ConnQueue {
+    int fds[QUEUE_SIZE];
+    uint32_t head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} ConnQueue;
+
+// Keys shared read-only by every worker.
+typedef struct Keys {
+    bool have_pub, have_priv;
+    mpz_t n, d, pq;
+} Keys;
+
+static ConnQueue queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER };
+static Keys keys;
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+// Makes the socket at path free to bind: removes a stale socket left by an earlier run, but
+// refuses to touch anything that is not a socket or a socket another daemon is listening on.
+static bool claim_path(const char *path, const struct sockaddr_un *addr) {
+    struct stat st;
+    if (lstat(path, &st) < 0) {
+        if (errno != ENOENT) {
+            perror(path);
+            return false;
+        }
+        return true;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s exists and is not a socket.\n", path);
+        return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, (const struct sockaddr *) addr, sizeof(*addr)) == 0) {
+        close(probe);
+        fprintf(stderr, "Another daemon is listening on %s.\n", path);
+        return false;
+    }
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (unlink(path) < 0) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+static void queue_push(int fd) {
+    pthread_mutex_lock(&queue.lock);
+    if (queue.count == QUEUE_SIZE) {
+        pthread_mutex_unlock(&queue.lock);
+        close(fd); // every worker is busy and the backlog is full
+        return;
+    }
+    queue.fds[(queue.head + queue.count) % QUEUE_SIZE] = fd;
+    queue.count += 1;
+    pthread_cond_signal(&queue.ready);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+static int queue_pop(void) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0) {
+        pthread_cond_wait(&queue.ready, &queue.lock);
+    }
+    int fd = queue.fds[queue.head];
+    queue.head = (queue.head + 1) % QUEUE_SIZE;
+    queue.count -= 1;
+    pthread_mutex_unlock(&queue.lock);
+    return fd;
+}
+
+// Runs one request through ctx into a malloc()ed *out. Returns false if ctx is missing or the
+// request is not valid ciphertext.
+static bool serve_one(SSKeyCtx *ctx, bool encrypt, const uint8_t *in, uint32_t len,
+    uint8_t **out, size_t *outlen) {
+    if (ctx == NULL) {
+        return false;
+    }
+    size_t cap = encrypt ? ss_encrypt_bound(ctx, len) : ss_decrypt_bound(ctx, len);
+    *out = (uint8_t *) malloc(cap + 1);
+    if (*out == NULL) {
+        return false;
+    }
+    return encrypt ? ss_encrypt_buf(ctx, in, len, *out, cap, outlen)
+                   : ss_decrypt_buf(ctx, in, len, *out, cap, outlen);
+}
+
+static void *worker(void *arg) {
+    (void) arg;
+    SSKeyCtx *enc = keys.have_pub ? ss_encrypt_ctx_create(keys.n) : NULL;
+    SSKeyCtx *dec = keys.have_priv ? ss_decrypt_ctx_create(keys.d, keys.pq) : NULL;
+
+    for (;;) {
+        int fd = queue_pop();
+        uint8_t op;
+        uint32_t len;
+        uint8_t *in;
+        while ((in = ssc_recv(fd, &op, &len)) != NULL) {
+            uint8_t *out = NULL;
+            size_t outlen = 0;
+            bool ok = false;
+            if (op == SSC_ENCRYPT || op == SSC_DECRYPT) {
+                ok = serve_one(op == SSC_ENCRYPT ? enc : dec, op == SSC_ENCRYPT, in, len, &out,
+                    &outlen);
+            }
+            free(in);
+
+            bool sent;
+            if (ok && outlen <= SSC_MAX_FRAME) {
+                sent = ssc_send(fd, SSC_OK, out, outlen);
+            } else {
+                const char *msg = op == SSC_ENCRYPT   ? (enc ? "failed" : "no public key loaded")
+                                  : op == SSC_DECRYPT ? (dec ? "invalid ciphertext"
+                                                             : "no private key loaded")
+                                                      : "unknown request";
+                sent = ssc_send(fd, SSC_ERROR, (const uint8_t *) msg, strlen(msg));
+            }
+            free(out);
+            if (!sent) {
+                break;
+            }
+        }
+        close(fd);
+        if (v_flag == true) {
+            fprintf(stderr, "connection %d closed\n", fd);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    char *pbfile = "ss.pub", *pvfile = "ss.priv", *path = SSC_SOCKET;
+    uint32_t workers = 4;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
+        switch (opt) {
+        case 'h': print_help(); return 0;
+        case 'v': v_flag = true; break;
+        case 'n': pbfile = optarg; break;
+        case 'd': pvfile = optarg; break;
+        case 'S': path = optarg; break;
+        case 'w': workers = strtoul(optarg, NULL, 10); break;
+        default:
+            print_help();
+            return 1;
+            break;
+        }
+    }
+    if (workers == 0) {
+        print_help();
+        return 1;
+    }
+
+    // Load whichever keys exist, once
+    mpz_inits(keys.n, keys.d, keys.pq, NULL);
+    FILE *pub_file = fopen(pbfile, "r");
+    if (pub_file != NULL) {
+        char username[LOGIN_NAME_MAX + 1];
+        ss_read_pub(keys.n, username, pub_file);
+        fclose(pub_file);
+        keys.have_pub = true;
+    }
+    FILE *priv_file = fopen(pvfile, "r");
+    if (priv_file != NULL) {
+        ss_read_priv(keys.pq, keys.d, priv_file);
+        fclose(priv_file);
+        keys.have_priv = true;
+    }
+    if (!keys.have_pub && !keys.have_priv) {
+        perror("Error opening key files");
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long.\n");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (!claim_path(path, &addr)) {
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t old_mask = umask(S_IRWXG | S_IRWXO); // the socket grants use of the private key
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(listener, 128) < 0) {
+        perror("Error creating socket");
+        return 1;
+    }
+    umask(old_mask);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal; // no SA_RESTART, so accept() returns on a signal
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (uint32_t i = 0; i < workers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, NULL) != 0) {
+            perror("Failed to start worker");
+            return 1;
+        }
+        pthread_detach(tid);
+    }
+    if (v_flag == true) {
+        fprintf(stderr, "listening on %s with %u workers (encrypt: %s, decrypt: %s)\n", path,
+            workers, keys.have_pub ? "yes" : "no", keys.have_priv ? "yes" : "no");
+    }
+
+    while (!stopping) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        // an idle or stalled client gives its worker back after IO_TIMEOUT
+        struct timeval tv = { .tv_sec = IO_TIMEOUT, .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        queue_push(fd);
+    }
+
+    close(listener);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// header files
+#include "ssclient.h"
+
+#define OPTIONS "hn:S:x:c:m:j:s:" //these are our argument options
+
+extern char **environ;
+
+void print_help(void) { // helper function for printing help
+    fprintf(stderr,
+
+        "SYNOPSIS\n"
+        "   Compares encrypting many small messages through a running ssd daemon against\n"
+        "   running the encrypt program once per message. Prints the results as JSON.\n"
+        "\n"
+        "USAGE\n"
+        "   ./ssdbench [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -n pbfile       Public key file for the encrypt runs (default: ss.pub).\n"
+        "   -S socket       Daemon socket path (default: ss.sock).\n"
+        "   -x encrypt      encrypt program to run per message (default: ./encrypt).\n"
+        "   -c count        Messages per path (default: 200).\n"
+        "   -m bytes        Message size (default: 64).\n"
+        "   -j clients      Concurrent clients (default: 1).\n"
+        "   -s seed         Seed for the message contents (default: 2024).\n");
+
+    return;
+}
+
+// Settings and results shared by the client threads of one run.
+typedef struct Run {
+    bool daemon;
+    const char *path, *pbfile, *encrypt;
+    const uint8_t *messages;
+    uint32_t count, size, clients;
+    double *ms; // latency of every message
+    uint32_t failures;
+    pthread_mutex_t lock;
+} Run;
+
+typedef struct Client {
+    Run *run;
+    uint32_t first, last; // messages [first, last)
+} Client;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// One encrypt process per message, fed through a pipe. Returns false if it failed.
+static bool encrypt_process(Run *run, const uint8_t *msg) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return false;
+    }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&fa, fds[1]);
+    char *argv[] = { (char *) run->encrypt, "-n", (char *) run->pbfile, "-o", "/dev/null", NULL };
+    pid_t pid;
+    int err = posix_spawn(&pid, run->encrypt, &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[0]);
+    if (err != 0) {
+        close(fds[1]);
+        return false;
+    }
+    bool ok = write(fds[1], msg, run->size) == (ssize_t) run->size;
+    close(fds[1]);
+    int status;
+    return waitpid(pid, &status, 0) == pid && ok && WIFEXITED(status)
+           && WEXITSTATUS(status) == 0;
+}
+
+static void *client(void *arg) {
+    Client *c = (Client *) arg;
+    Run *run = c->run;
+    uint32_t failures = 0;
+
+    int fd = -1;
+    if (run->daemon && (fd = ssc_connect(run->path)) < 0) {
+        perror("Error connecting to daemon");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = c->first; i < c->last; i++) {
+        const uint8_t *msg = run->messages + (size_t) i * run->size;
+        double t = now();
+        bool ok;
+        if (run->daemon) {
+            uint8_t status;
+            uint32_t len;
+            uint8_t *out = ssc_call(fd, SSC_ENCRYPT, msg, run->size, &status, &len);
+            ok = out != NULL && status == SSC_OK;
+            free(out);
+        } else {
+            ok = encrypt_process(run, msg);
+        }
+        run->ms[i] = 1e3 * (now() - t);
+        failures += !ok;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    pthread_mutex_lock(&run->lock);
+    run->failures += failures;
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+// Runs every message through one path and prints its JSON object. Returns messages per second.
+static double bench(Run *run, const char *name, bool last) {
+    pthread_t tids[run->clients];
+    Client clients[run->clients];
+    double start = now();
+    for (uint32_t i = 0; i < run->clients; i++) {
+        clients[i].run = run;
+        clients[i].first = (uint64_t) run->count * i / run->clients;
+        clients[i].last = (uint64_t) run->count * (i + 1) / run->clients;
+        if (pthread_create(&tids[i], NULL, client, &clients[i]) != 0) {
+            perror("Failed to start client");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint32_t i = 0; i < run->clients; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double rate = run->count / (now() - start);
+
+    qsort(run->ms, run->count, sizeof(double), cmp_double);
+    printf("  \"%s\": {\"msgs_per_s\": %.1f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+           "\"failures\": %u}%s\n",
+        name, rate, run->ms[run->count / 2], run->ms[(run->count * 99) / 100],
+        run->ms[run->count - 1], run->failures, last ? "" : ",");
+    return rate;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    Run run = { .path = SSC_SOCKET, .pbfile = "ss.pub", .encrypt = "./encrypt", .count = 200,
+        .size = 64, .clients = 1, .lock = PTHREAD_MUTEX_INITIALIZER };
+    uint64_t seed = 2024;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
+        switch (opt) {
+        case 'h': print_help(); return 0;
+        case 'n': run.pbfile = optarg; break;
+        case 'S': run.path = optarg; break;
+        case 'x': run.encrypt = optarg; break;
+        case 'c': run.count = strtoul(optarg, NULL, 10); break;
+        case 'm': run.size = strtoul(optarg, NULL, 10); break;
+        case 'j': run.clients = strtoul(optarg, NULL, 10); break;
+        case 's': seed = strtoul(optarg, NULL, 10); break;
+        default:
+            print_help();
+            return 1;
+            break;
+        }
+    }
+    if (run.count == 0 || run.size == 0 || run.clients == 0 || run.clients > run.count) {
+        print_help();
+        return 1;
+    }
+
+    uint8_t *messages = (uint8_t *) malloc((size_t) run.count * run.size);
+    run.ms = (double *) malloc(run.count * sizeof(double));
+    if (messages == NULL || run.ms == NULL) {
+        perror("Failed to allocate messages");
+        return 1;
+    }
+    srandom(seed);
+    for (size_t i = 0; i < (size_t) run.count * run.size; i++) {
+        messages[i] = random() & 0xFF;
+    }
+    run.messages = messages;
+
+    printf("{\n  \"messages\": %u,\n  \"bytes\": %u,\n  \"clients\": %u,\n", run.count, run.size,
+        run.clients);
+    run.daemon = false;
+    double per_process = bench(&run, "per_process", false);
+    run.daemon = true;
+    run.failures = 0;
+    double daemon = bench(&run, "daemon", false);
+    printf("  \"speedup\": %.1f\n}\n", daemon / per_process);
+
+    free(messages);
+    free(run.ms);
+    return 0;
+}
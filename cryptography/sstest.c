@@ -0,0 +1,206 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// header files
+#include "randstate.h"
+#include "ss.h"
+
+#define OPTIONS "hs:" //these are our argument options
+
+void print_help(void) { // helper function for printing help
+    fprintf(stderr,
+
+        "SYNOPSIS\n"
+        "   Checks that ss_encrypt_buf and ss_decrypt_buf produce the same bytes as the file\n"
+        "   functions, stay within ss_encrypt_bound/ss_decrypt_bound, refuse a short output\n"
+        "   buffer and reject ciphertext that is not of the key. Exits non-zero on a failure.\n"
+        "\n"
+        "USAGE\n"
+        "   ./sstest [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h              Display program help and usage.\n"
+        "   -s seed         Random seed for keys and messages (default: 2024).\n");
+
+    return;
+}
+
+static uint64_t checked = 0, failed = 0;
+
+// Counts one check and reports it if it failed.
+static void expect(bool ok, const char *what, uint64_t bits, size_t len) {
+    checked += 1;
+    if (!ok) {
+        failed += 1;
+        fprintf(stderr, "%s failed (%" PRIu64 "-bit key, %zu-byte input)\n", what, bits, len);
+    }
+}
+
+// Returns a temporary stream holding the len bytes of data, positioned at the start.
+static FILE *stream_of(const uint8_t *data, size_t len) {
+    FILE *f = tmpfile();
+    if (f == NULL || fwrite(data, 1, len, f) != len) {
+        perror("tmpfile");
+        exit(EXIT_FAILURE);
+    }
+    rewind(f);
+    return f;
+}
+
+// Reads all of f into a malloc'd buffer, with its length in *len, and closes f.
+static uint8_t *contents(FILE *f, size_t *len) {
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    uint8_t *data = (uint8_t *) malloc(*len + 1);
+    if (data == NULL || fread(data, 1, *len, f) != *len) {
+        perror("fread");
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    return data;
+}
+
+// Encrypts and decrypts msg through both the file and the buffer functions and compares them.
+static void check_message(
+    SSKeyCtx *enc, SSKeyCtx *dec, uint64_t bits, const uint8_t *msg, size_t len) {
+    FILE *in = stream_of(msg, len), *out = tmpfile();
+    ss_encrypt_file_ctx(in, out, enc);
+    fclose(in);
+    size_t file_len;
+    uint8_t *file_cipher = contents(out, &file_len);
+
+    // the bound is the buffer size ssd allocates, so the ciphertext has to fit it
+    size_t cap = ss_encrypt_bound(enc, len), cipher_len = 0;
+    uint8_t *cipher = (uint8_t *) malloc(cap + 1);
+    bool ok = ss_encrypt_buf(enc, msg, len, cipher, cap, &cipher_len);
+    expect(ok && cipher_len <= cap, "ss_encrypt_buf within ss_encrypt_bound", bits, len);
+    expect(ok && cipher_len == file_len && memcmp(cipher, file_cipher, file_len) == 0,
+        "ss_encrypt_buf matching ss_encrypt_file_ctx", bits, len);
+    if (cipher_len > 0) {
+        size_t n;
+        expect(!ss_encrypt_buf(enc, msg, len, cipher, cipher_len - 1, &n),
+            "ss_encrypt_buf refusing a short buffer", bits, len);
+    }
+
+    in = stream_of(file_cipher, file_len);
+    out = tmpfile();
+    expect(ss_decrypt_file_ctx(in, out, dec), "ss_decrypt_file_ctx", bits, len);
+    fclose(in);
+    size_t file_plain_len;
+    uint8_t *file_plain = contents(out, &file_plain_len);
+    expect(file_plain_len == len && memcmp(file_plain, msg, len) == 0,
+        "ss_decrypt_file_ctx round trip", bits, len);
+
+    size_t plain_cap = ss_decrypt_bound(dec, file_len), plain_len = 0;
+    uint8_t *plain = (uint8_t *) malloc(plain_cap + 1);
+    ok = ss_decrypt_buf(dec, file_cipher, file_len, plain, plain_cap, &plain_len);
+    expect(ok && plain_len <= plain_cap, "ss_decrypt_buf within ss_decrypt_bound", bits, len);
+    expect(ok && plain_len == len && memcmp(plain, msg, len) == 0,
+        "ss_decrypt_buf round trip", bits, len);
+    if (len > 0) {
+        size_t n;
+        expect(!ss_decrypt_buf(dec, file_cipher, file_len, plain, len - 1, &n),
+            "ss_decrypt_buf refusing a short buffer", bits, len);
+    }
+
+    free(file_cipher);
+    free(cipher);
+    free(file_plain);
+    free(plain);
+}
+
+// Both decryptors must reject text, and must agree on what they decrypted before rejecting it.
+static void check_rejected(SSKeyCtx *dec, uint64_t bits, const char *text) {
+    size_t len = strlen(text);
+    FILE *in = stream_of((const uint8_t *) text, len), *out = tmpfile();
+    expect(!ss_decrypt_file_ctx(in, out, dec), "ss_decrypt_file_ctx rejecting bad input", bits,
+        len);
+    fclose(in);
+    size_t file_len;
+    uint8_t *file_plain = contents(out, &file_len);
+
+    size_t cap = ss_decrypt_bound(dec, len), plain_len = 0;
+    uint8_t *plain = (uint8_t *) malloc(cap + 1);
+    bool ok = ss_decrypt_buf(dec, (const uint8_t *) text, len, plain, cap, &plain_len);
+    expect(!ok && plain_len == file_len && memcmp(plain, file_plain, file_len) == 0,
+        "ss_decrypt_buf rejecting bad input like ss_decrypt_file_ctx", bits, len);
+    free(file_plain);
+    free(plain);
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    uint64_t seed = 2024;
+
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) { //while loop to parse arguments
+        switch (opt) {
+        case 'h': print_help(); return 0;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            print_help();
+            return 1;
+            break;
+        }
+    }
+
+    randstate_init(seed);
+    const uint64_t sizes[] = { 256, 1024 };
+
+    mpz_t p, q, n, d, pq;
+    mpz_inits(p, q, n, d, pq, NULL);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint64_t before = failed;
+        ss_make_pub(p, q, n, sizes[s], 50);
+        ss_make_priv(d, pq, p, q);
+        SSKeyCtx *enc = ss_encrypt_ctx_create(n);
+        SSKeyCtx *dec = ss_decrypt_ctx_create(d, pq);
+        if (enc == NULL || dec == NULL) {
+            perror("ss_ctx_create");
+            return 1;
+        }
+
+        // empty, one byte, around one and two blocks, and several blocks
+        uint64_t k = enc->k;
+        const size_t lens[] = { 0, 1, k - 2, k - 1, k, 2 * (k - 1), 2 * (k - 1) + 1, 3000 };
+        uint8_t msg[3000];
+        for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+            for (size_t b = 0; b < lens[i]; b++) {
+                msg[b] = gmp_urandomb_ui(state, 8);
+            }
+            if (lens[i] > 0) {
+                msg[0] = 0; // a leading zero byte must survive the 0xFF pad
+            }
+            check_message(enc, dec, sizes[s], msg, lens[i]);
+        }
+
+        // a valid block, then a line that is not hex; 0 and pq, which decrypt to no block
+        size_t cipher_len;
+        char good[2048], text[4096];
+        ss_encrypt_buf(enc, (const uint8_t *) "ok", 2, (uint8_t *) good, sizeof(good) - 1,
+            &cipher_len);
+        good[cipher_len] = '\0';
+        snprintf(text, sizeof(text), "%szzzz\n", good);
+        check_rejected(dec, sizes[s], text);
+        check_rejected(dec, sizes[s], "0\n");
+        gmp_snprintf(text, sizeof(text), "%s%Zx\n", good, pq);
+        check_rejected(dec, sizes[s], text);
+
+        ss_ctx_delete(enc);
+        ss_ctx_delete(dec);
+        printf("%4" PRIu64 " bits: %s\n", sizes[s], failed == before ? "ok" : "FAILED");
+    }
+    printf("%" PRIu64 " checks, %" PRIu64 " failures\n", checked, failed);
+
+    mpz_clears(p, q, n, d, pq, NULL);
+    randstate_clear();
+    return failed == 0 ? 0 : 1;
+}
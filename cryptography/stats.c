@@ -0,0 +1,51 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "stats.h"
+
+#ifdef SS_STATS
+
+_Atomic uint64_t stats[STAT_COUNT];
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns a / b, or 0 when nothing was counted.
+static double ratio(uint64_t a, uint64_t b) {
+    return b == 0 ? 0 : (double) a / b;
+}
+
+void stats_report(FILE *out) {
+    uint64_t s[STAT_COUNT];
+    for (int i = 0; i < STAT_COUNT; i++) {
+        s[i] = atomic_load(&stats[i]);
+    }
+    fprintf(out,
+        "{\"enabled\": true, "
+        "\"make_prime\": {\"primes\": %" PRIu64 ", \"candidates\": %" PRIu64 ", "
+        "\"candidates_per_prime\": %.2f}, "
+        "\"is_prime\": {\"calls\": %" PRIu64 ", \"mr_rounds\": %" PRIu64 ", "
+        "\"early_rejects\": %" PRIu64 "}, "
+        "\"pow_mod\": {\"calls\": %" PRIu64 ", \"exponent_bits\": %" PRIu64 ", "
+        "\"mean_exponent_bits\": %.1f}, "
+        "\"ss_make_pub\": {\"regenerations\": %" PRIu64 "}, "
+        "\"blocks\": {\"count\": %" PRIu64 ", \"crypto_ms\": %.3f, \"io_ms\": %.3f, "
+        "\"us_per_block\": %.2f}}\n",
+        s[STAT_PRIMES], s[STAT_CANDIDATES], ratio(s[STAT_CANDIDATES], s[STAT_PRIMES]),
+        s[STAT_PRIME_TESTS], s[STAT_MR_ROUNDS], s[STAT_EARLY_REJECTS], s[STAT_POW_MOD],
+        s[STAT_POW_MOD_BITS], ratio(s[STAT_POW_MOD_BITS], s[STAT_POW_MOD]), s[STAT_REGENERATIONS],
+        s[STAT_BLOCKS], s[STAT_BLOCK_NS] / 1e6, s[STAT_IO_NS] / 1e6,
+        ratio(s[STAT_BLOCK_NS], s[STAT_BLOCKS]) / 1e3);
+}
+
+#else
+
+void stats_report(FILE *out) {
+    fprintf(out, "{\"enabled\": false}\n");
+}
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+//
+// Instrumentation counters and timers for keygen, encrypt and decrypt. They are only compiled in
+// when SS_STATS is defined (make STATS=1); otherwise every STAT_* macro expands to nothing and the
+// hot loops are unchanged. Counters are atomic, so the parallel prime search can share them.
+//
+typedef enum {
+    STAT_PRIMES, // primes returned by make_prime
+    STAT_CANDIDATES, // candidates make_prime sent to the primality test
+    STAT_PRIME_TESTS, // is_prime calls
+    STAT_MR_ROUNDS, // strong probable-prime rounds run
+    STAT_EARLY_REJECTS, // composites rejected before a second round (trivial checks or round 1)
+    STAT_POW_MOD, // pow_mod and pow_mod_cached calls
+    STAT_POW_MOD_BITS, // total exponent bits over those calls
+    STAT_REGENERATIONS, // p/q pairs ss_make_pub threw away
+    STAT_BLOCKS, // blocks encrypted or decrypted by ss_encrypt_file/ss_decrypt_file
+    STAT_BLOCK_NS, // time spent on the modular exponentiation of those blocks
+    STAT_IO_NS, // time spent reading and writing those blocks
+    STAT_COUNT
+} Stat;
+
+#ifdef SS_STATS
+#include <stdatomic.h>
+
+extern _Atomic uint64_t stats[STAT_COUNT];
+
+// Monotonic clock in nanoseconds.
+uint64_t stats_now(void);
+
+// Adds n to counter s.
+#define STAT_ADD(s, n) atomic_fetch_add_explicit(&stats[s], (uint64_t) (n), memory_order_relaxed)
+
+// Declares timer t, started now.
+#define STAT_TIMER(t) uint64_t t = stats_now()
+
+// Adds the time since timer t to counter s and restarts t.
+#define STAT_LAP(s, t)                                                                             \
+    do {                                                                                           \
+        uint64_t lap_ = stats_now();                                                               \
+        STAT_ADD(s, lap_ - (t));                                                                   \
+        (t) = lap_;                                                                                \
+    } while (0)
+#else
+#define STAT_ADD(s, n) ((void) 0)
+#define STAT_TIMER(t)  ((void) 0)
+#define STAT_LAP(s, t) ((void) 0)
+#endif
+
+//
+// Writes every counter, plus derived averages, to out as one JSON object. Without SS_STATS it
+// writes {"enabled": false}.
+//
+void stats_report(FILE *out);
@@ -0,0 +1,317 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define SHARD_BUCKETS 256 // hash chains per shard
+
+// One independently locked part of the cache, with its own share of the budgets. Paths
+// are spread over the shards by hash, so threads serving different files rarely meet.
+typedef struct {
+
+    pthread_mutex_t lock;
+    CacheEntry *buckets[SHARD_BUCKETS];
+    CacheEntry *head, *tail; // most and least recently used
+    size_t bytes, max_bytes;
+    uint64_t max_files;
+    uint64_t hits, misses, evictions, entries;
+    uint64_t generation; // bumped by cache_invalidate(), so an open that raced one can tell
+
+} Shard;
+
+static Shard shards[CACHE_SHARDS];
+static int root_fd = AT_FDCWD;
+static size_t cache_bytes = 0;
+static int cache_files = 0;
+static const char *cache_head = "";
+
+static uint64_t clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a
+static uint64_t hash_path(const char *path) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *path != '\0'; path++) {
+        h = (h ^ (unsigned char) *path) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static Shard *shard_of(uint64_t h) {
+    return &shards[h % CACHE_SHARDS];
+}
+
+static CacheEntry **bucket_of(Shard *s, uint64_t h) {
+    return &s->buckets[(h / CACHE_SHARDS) % SHARD_BUCKETS];
+}
+
+static CacheEntry *find(Shard *s, uint64_t h, const char *path) {
+    for (CacheEntry *e = *bucket_of(s, h); e != NULL; e = e->chain) {
+        if (e->hash == h && strcmp(e->path, path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static int same_version(const CacheEntry *e, const struct stat *st) {
+    return e->st.st_dev == st->st_dev && e->st.st_ino == st->st_ino
+           && e->st.st_size == st->st_size && e->st.st_mtim.tv_sec == st->st_mtim.tv_sec
+           && e->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void entry_free(CacheEntry *e) {
+    close(e->fd);
+    if (e->lz_fd >= 0) {
+        close(e->lz_fd);
+    }
+    free(e->path);
+    free(e->data);
+    free(e);
+}
+
+// Drops one reference; the shard lock must be held.
+static void entry_put(CacheEntry *e) {
+    if (--e->refs == 0) {
+        entry_free(e);
+    }
+}
+
+static void lru_remove(Shard *s, CacheEntry *e) {
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        s->head = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        s->tail = e->prev;
+    }
+}
+
+static void lru_push(Shard *s, CacheEntry *e) {
+    e->prev = NULL;
+    e->next = s->head;
+    if (s->head != NULL) {
+        s->head->prev = e;
+    } else {
+        s->tail = e;
+    }
+    s->head = e;
+}
+
+// Takes e out of the shard and drops the shard's reference to it.
+static void unlink_entry(Shard *s, CacheEntry *e) {
+    CacheEntry **link = bucket_of(s, e->hash);
+    while (*link != e) {
+        link = &(*link)->chain;
+    }
+    *link = e->chain;
+    lru_remove(s, e);
+    s->bytes -= e->len;
+    s->entries -= 1;
+    entry_put(e);
+}
+
+// Reads a small regular file into its response. Failing only means it is sent from e->fd.
+static void entry_fill(CacheEntry *e) {
+    off_t size = e->st.st_size;
+    if (cache_bytes == 0 || !S_ISREG(e->st.st_mode) || size > CACHE_MAX_OBJECT
+        || (size_t) size * 2 > shards[0].max_bytes) {
+        return;
+    }
+
+    char head[256];
+    int head_len = snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\nContent-Length: %jd\r\nAccept-Ranges: bytes\r\nETag: %s\r\n"
+        "Last-Modified: %s\r\n%s\r\n",
+        (intmax_t) size, e->etag, e->modified, cache_head);
+    char *data = malloc(head_len + size);
+    if (data == NULL) {
+        return;
+    }
+    memcpy(data, head, head_len);
+
+    off_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(e->fd, data + head_len + got, size - got, got);
+        if (n <= 0) {
+            free(data); // shrank under us
+            return;
+        }
+        got += n;
+    }
+    e->data = data;
+    e->head_len = head_len;
+    e->len = head_len + size;
+}
+
+// Opens path below the root into a new entry holding one reference.
+static CacheEntry *entry_open(const char *path, uint64_t h, uint64_t now) {
+    int fd = openat(root_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    CacheEntry *e = calloc(1, sizeof(CacheEntry));
+    char *name = strdup(path);
+    if (e == NULL || name == NULL || fstat(fd, &e->st) < 0) {
+        free(e);
+        free(name);
+        close(fd);
+        return NULL;
+    }
+    e->path = name;
+    e->hash = h;
+    e->fd = fd;
+    e->checked = now;
+    e->refs = 1;
+    e->lz_fd = -1;
+    cache_etag(e->etag, sizeof(e->etag), &e->st);
+    cache_http_date(e->modified, sizeof(e->modified), &e->st);
+    entry_fill(e);
+    return e;
+}
+
+void cache_init(int root, size_t max_bytes, int max_files, const char *head) {
+    root_fd = root;
+    cache_head = head;
+    cache_bytes = max_bytes;
+    cache_files = max_files;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].max_bytes = max_bytes / CACHE_SHARDS;
+        shards[i].max_files = (max_files + CACHE_SHARDS - 1) / CACHE_SHARDS;
+    }
+}
+
+CacheEntry *cache_open(const char *path) {
+    uint64_t h = hash_path(path);
+    Shard *s = shard_of(h);
+    uint64_t now = clock_ms();
+
+    pthread_mutex_lock(&s->lock);
+    uint64_t generation = s->generation;
+    CacheEntry *e = cache_files > 0 ? find(s, h, path) : NULL;
+    if (e != NULL) {
+        e->refs += 1;
+        lru_remove(s, e);
+        lru_push(s, e);
+        if (now - e->checked < CACHE_TTL_MS) {
+            s->hits += 1;
+            pthread_mutex_unlock(&s->lock);
+            return e;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    // past its TTL: one fstatat() tells whether path still names the file that is open
+    if (e != NULL) {
+        struct stat st;
+        if (fstatat(root_fd, path, &st, 0) == 0 && same_version(e, &st)) {
+            pthread_mutex_lock(&s->lock);
+            e->checked = now;
+            s->hits += 1;
+            pthread_mutex_unlock(&s->lock);
+            return e;
+        }
+        cache_release(e);
+    }
+
+    e = entry_open(path, h, now);
+    pthread_mutex_lock(&s->lock);
+    s->misses += 1;
+    // a PUT may have renamed a new version in after entry_open() got the old one; that old one
+    // still answers this request, but must not be cached past the PUT's invalidation
+    if (e == NULL || cache_files == 0 || !S_ISREG(e->st.st_mode) || s->generation != generation) {
+        pthread_mutex_unlock(&s->lock);
+        return e; // not shared, closed on release
+    }
+
+    CacheEntry *old = find(s, h, path);
+    if (old != NULL) {
+        unlink_entry(s, old); // replaced, or another thread opened it at the same time
+    }
+    CacheEntry **bucket = bucket_of(s, h);
+    e->chain = *bucket;
+    *bucket = e;
+    lru_push(s, e);
+    e->refs += 1; // the shard's
+    s->bytes += e->len;
+    s->entries += 1;
+    while ((s->bytes > s->max_bytes || s->entries > s->max_files) && s->tail != e) {
+        unlink_entry(s, s->tail);
+        s->evictions += 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return e;
+}
+
+void cache_retain(CacheEntry *e) {
+    Shard *s = shard_of(e->hash);
+    pthread_mutex_lock(&s->lock);
+    e->refs += 1;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void cache_release(CacheEntry *e) {
+    Shard *s = shard_of(e->hash);
+    pthread_mutex_lock(&s->lock);
+    entry_put(e);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void cache_invalidate(const char *path) {
+    if (cache_files == 0) {
+        return;
+    }
+    uint64_t h = hash_path(path);
+    Shard *s = shard_of(h);
+    pthread_mutex_lock(&s->lock);
+    s->generation += 1;
+    CacheEntry *e = find(s, h, path);
+    if (e != NULL) {
+        unlink_entry(s, e);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+void cache_stats(CacheStats *stats) {
+    memset(stats, 0, sizeof(CacheStats));
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        Shard *s = &shards[i];
+        pthread_mutex_lock(&s->lock);
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->evictions += s->evictions;
+        stats->entries += s->entries;
+        stats->bytes += s->bytes;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void cache_version(char *buf, size_t n, const struct stat *st) {
+    uint64_t mtime = (uint64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    snprintf(buf, n, "%jx-%jx-%jx", (uintmax_t) st->st_ino, (uintmax_t) st->st_size,
+        (uintmax_t) mtime);
+}
+
+void cache_etag(char *buf, size_t n, const struct stat *st) {
+    char version[48];
+    cache_version(version, sizeof(version), st);
+    snprintf(buf, n, "\"%s\"", version);
+}
+
+void cache_http_date(char *buf, size_t n, const struct stat *st) {
+    struct tm tm;
+    gmtime_r(&st->st_mtime, &tm);
+    strftime(buf, n, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
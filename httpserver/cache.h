@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define CACHE_SHARDS     16 // independently locked parts of the cache
+#define CACHE_MAX_OBJECT (1 << 20) // larger files are always sent from disk
+#define CACHE_TTL_MS     1000 // how long an entry is trusted before fstatat() checks it again
+
+// An open file below the served root and what fstat() said about it. Small regular files
+// also carry their whole GET response: the head, blank line included, followed by the file.
+// Entries are reference counted, so one evicted or invalidated while it is being sent stays
+// usable until cache_release().
+typedef struct CacheEntry {
+
+    char *path;
+    uint64_t hash; // of path, picks the shard and bucket
+    int fd; // shared by every request for the file, read with pread()/sendfile() only
+    struct stat st;
+    uint64_t checked; // ms timestamp of the last check that path still names this file
+    char etag[64]; // validators of this version, for conditional requests
+    char modified[32]; // Last-Modified date
+    int lz_state; // compressed copy: unknown, being made, ready or not worth sending
+    int lz_fd; // the ready copy, -1 until then
+    off_t lz_size;
+    char *data; // cached response, or NULL to send from fd
+    size_t len; // head_len + st.st_size, 0 without data
+    size_t head_len;
+    int refs;
+    struct CacheEntry *chain; // next entry in the same hash bucket
+    struct CacheEntry *prev, *next; // shard LRU list, most recently used first
+
+} CacheEntry;
+
+typedef struct {
+
+    uint64_t hits, misses, evictions;
+    uint64_t entries, bytes;
+
+} CacheStats;
+
+// Paths are looked up relative to the directory root. At most max_files descriptors stay open
+// and max_bytes of responses stay in memory, beyond those in use; max_files 0 turns the cache
+// off, max_bytes 0 only keeps descriptors. Cached heads end with the header lines in head.
+void cache_init(int root, size_t max_bytes, int max_files, const char *head);
+
+// Returns the entry for path, opening the file if it is not cached or has been replaced since.
+// Returns NULL with errno set if it cannot be opened. The entry must be given back with
+// cache_release().
+CacheEntry *cache_open(const char *path);
+
+// Takes another reference to e, for work that outlives the request that found it.
+void cache_retain(CacheEntry *e);
+
+void cache_release(CacheEntry *e);
+
+// Drops path from the cache, for when it has just been replaced. A cache_open() of a path in
+// the same shard that was already under way keeps what it opened to itself instead of caching it.
+void cache_invalidate(const char *path);
+
+void cache_stats(CacheStats *stats);
+
+// Writes the version of the file st describes: inode, size and modification time.
+void cache_version(char *buf, size_t n, const struct stat *st);
+
+// Writes the ETag of the file version st describes, its quoted version.
+void cache_etag(char *buf, size_t n, const struct stat *st);
+
+// Writes st's modification time as an HTTP-date.
+void cache_http_date(char *buf, size_t n, const struct stat *st);
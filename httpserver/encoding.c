@@ -0,0 +1,311 @@
+#define _GNU_SOURCE // posix_spawn_file_actions_addclosefrom_np(), prlimit()
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "encoding.h"
+
+// CacheEntry.lz_state
+#define LZ_UNKNOWN 0
+#define LZ_PENDING 1
+#define LZ_READY   2
+#define LZ_NONE    3 // compressing did not make it smaller
+
+extern char **environ;
+
+static int root_fd = -1;
+static int sidecar_fd = -1; // ENCODING_DIR
+static char encode_path[PATH_MAX], decode_path[PATH_MAX];
+static pthread_mutex_t lz_lock = PTHREAD_MUTEX_INITIALIZER; // every entry's lz_ fields
+static int jobs = 0; // compressions running
+static atomic_ulong jobs_started = 0; // numbers their temporary files
+
+// The codec keeps its state in globals and exits on I/O errors, so it runs in its own process
+// rather than in a server thread: stdin in, stdout out, no other descriptor of ours.
+static pid_t spawn(const char *prog, int in, int out) {
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, in, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, out, STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addclosefrom_np(&fa, STDERR_FILENO + 1);
+    char *argv[] = { (char *) prog, NULL };
+    pid_t pid;
+    int err = posix_spawn(&pid, prog, &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    return err == 0 ? pid : -1;
+}
+
+// Name of the compressed copy of one version of path: request paths have no digits, so the
+// version cannot run into another path's name.
+static void sidecar_name(char *buf, size_t n, const char *path, const struct stat *st) {
+    char version[48];
+    cache_version(version, sizeof(version), st);
+    snprintf(buf, n, "%s.%s", path, version);
+}
+
+// True if name is a sidecar of path: path, '.', then three hex numbers joined by '-'. Paths
+// have no '-', so a longer path that starts with this one never matches.
+static int sidecar_of(const char *name, const char *path) {
+    size_t len = strlen(path);
+    if (strncmp(name, path, len) != 0 || name[len] != '.') {
+        return 0;
+    }
+    const char *v = name + len + 1;
+    for (int fields = 1;; fields++) {
+        size_t n = strspn(v, "0123456789abcdef");
+        if (n == 0) {
+            return 0;
+        }
+        v += n;
+        if (*v == '\0') {
+            return fields == 3;
+        }
+        if (*v++ != '-') {
+            return 0;
+        }
+    }
+}
+
+// Removes path's sidecars other than keep, left behind by versions changed outside the server.
+static void drop_stale(const char *path, const char *keep) {
+    int fd = openat(sidecar_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, keep) != 0 && sidecar_of(d->d_name, path)) {
+            unlinkat(sidecar_fd, d->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+// Compresses e's file version into its sidecar. Runs on its own thread holding a reference.
+static void *compress_job(void *arg) {
+    CacheEntry *e = arg;
+    char name[PATH_MAX], tmp[PATH_MAX + 32];
+    sidecar_name(name, sizeof(name), e->path, &e->st);
+    snprintf(tmp, sizeof(tmp), ".tmp-%d-%lu", getpid(), atomic_fetch_add(&jobs_started, 1));
+
+    // a descriptor of its own, since the encoder moves the file offset as it reads
+    int state = LZ_NONE, lz_fd = -1;
+    off_t lz_size = 0;
+    int in = openat(root_fd, e->path, O_RDONLY | O_CLOEXEC);
+    int out = openat(sidecar_fd, tmp, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    struct stat st;
+    char now[PATH_MAX];
+    if (in >= 0 && out >= 0 && fstat(in, &st) == 0) {
+        sidecar_name(now, sizeof(now), e->path, &st);
+        pid_t pid = strcmp(now, name) == 0 ? spawn(encode_path, in, out) : -1;
+        if (pid > 0 && encoding_finish(pid, 1) == 0 && fstat(out, &st) == 0
+            && st.st_size < e->st.st_size && renameat(sidecar_fd, tmp, sidecar_fd, name) == 0) {
+            lz_fd = openat(sidecar_fd, name, O_RDONLY | O_CLOEXEC);
+            lz_size = st.st_size;
+            state = lz_fd >= 0 ? LZ_READY : LZ_NONE;
+
+            // only while this is still the current version, so an older job cannot drop a newer
+            if (fstatat(root_fd, e->path, &st, 0) == 0) {
+                sidecar_name(now, sizeof(now), e->path, &st);
+                if (strcmp(now, name) == 0) {
+                    drop_stale(e->path, name);
+                }
+            }
+        }
+    }
+    if (state != LZ_READY) {
+        unlinkat(sidecar_fd, tmp, 0);
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    if (out >= 0) {
+        close(out);
+    }
+
+    pthread_mutex_lock(&lz_lock);
+    e->lz_fd = lz_fd;
+    e->lz_size = lz_size;
+    e->lz_state = state;
+    jobs -= 1;
+    pthread_mutex_unlock(&lz_lock);
+    cache_release(e);
+    return NULL;
+}
+
+int encoding_init(int root, const char *codec_dir) {
+    snprintf(encode_path, sizeof(encode_path), "%s/encode", codec_dir);
+    snprintf(decode_path, sizeof(decode_path), "%s/decode", codec_dir);
+    if (access(encode_path, X_OK) < 0 || access(decode_path, X_OK) < 0) {
+        return -1;
+    }
+    if (mkdirat(root, ENCODING_DIR, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    sidecar_fd = openat(root, ENCODING_DIR, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (sidecar_fd < 0) {
+        return -1;
+    }
+    root_fd = root;
+    return 0;
+}
+
+int encoding_enabled(void) {
+    return sidecar_fd >= 0;
+}
+
+int encoding_accepted(const char *value) {
+    const char *p = value;
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char *token = p;
+        while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        size_t len = p - token;
+        int ours = (len == strlen(ENCODING_NAME) && strncasecmp(token, ENCODING_NAME, len) == 0)
+                   || (len == 1 && *token == '*');
+
+        // q=0 means "not this one"
+        double q = 1;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == ';') {
+            p++;
+            while (*p == ' ' || *p == '\t') {
+                p++;
+            }
+            if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                q = strtod(p + 2, NULL);
+            }
+        }
+        if (ours && q > 0) {
+            return 1;
+        }
+        while (*p != '\0' && *p != ',') {
+            p++;
+        }
+    }
+    return 0;
+}
+
+int encoding_get(CacheEntry *e, off_t *size) {
+    if (!encoding_enabled() || !S_ISREG(e->st.st_mode) || e->st.st_size < ENCODING_MIN) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lz_lock);
+    if (e->lz_state == LZ_UNKNOWN) {
+        // made by an earlier request for this version, perhaps before a restart
+        char name[PATH_MAX];
+        sidecar_name(name, sizeof(name), e->path, &e->st);
+        int fd = openat(sidecar_fd, name, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            e->lz_fd = fd;
+            e->lz_size = st.st_size;
+            e->lz_state = LZ_READY;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (e->lz_state == LZ_UNKNOWN && jobs < ENCODING_JOBS) {
+        pthread_t tid;
+        cache_retain(e);
+        if (pthread_create(&tid, NULL, compress_job, e) == 0) {
+            pthread_detach(tid);
+            e->lz_state = LZ_PENDING;
+            jobs += 1;
+        } else {
+            cache_release(e);
+        }
+    }
+    int fd = -1;
+    if (e->lz_state == LZ_READY) {
+        fd = e->lz_fd;
+        *size = e->lz_size;
+    }
+    pthread_mutex_unlock(&lz_lock);
+    return fd;
+}
+
+int encoding_decoder(int out, pid_t *pid, int nonblock) {
+    int fds[2];
+    if (!encoding_enabled() || pipe2(fds, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    *pid = spawn(decode_path, fds[0], out);
+    close(fds[0]);
+
+    // decode reads before it writes, so the limit is in place before its first byte of output
+    struct rlimit cap = { ENCODING_MAX_DECODED, ENCODING_MAX_DECODED };
+    if (*pid > 0 && prlimit(*pid, RLIMIT_FSIZE, &cap, NULL) < 0) {
+        kill(*pid, SIGKILL);
+        encoding_finish(*pid, 1);
+        *pid = -1;
+    }
+    if (*pid < 0) {
+        close(fds[1]);
+        return -1;
+    }
+    if (nonblock) {
+        fcntl(fds[1], F_SETFL, O_NONBLOCK); // our end only: decode reads as usual
+    }
+    return fds[1];
+}
+
+int encoding_finish(pid_t pid, int wait) {
+    int status;
+    pid_t done;
+    while ((done = waitpid(pid, &status, wait ? 0 : WNOHANG)) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    if (done == 0) {
+        return 1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int encoding_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void encoding_drop(const char *path, const struct stat *old) {
+    if (!encoding_enabled()) {
+        return;
+    }
+    char name[PATH_MAX];
+    sidecar_name(name, sizeof(name), path, old);
+    unlinkat(sidecar_fd, name, 0);
+}
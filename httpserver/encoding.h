@@ -0,0 +1,41 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "cache.h"
+
+#define ENCODING_NAME "lz78" // Content-Encoding of the ../compression encode format
+#define ENCODING_DIR  ".lz78" // compressed copies below the root, one per file version
+#define ENCODING_MIN  256 // smaller files are always sent as they are
+#define ENCODING_JOBS 2 // files compressed at the same time
+#define ENCODING_MAX_DECODED (1L << 30) // bytes an encoded PUT body may decode to
+
+// Uses the encode and decode programs in codec_dir and keeps compressed copies in ENCODING_DIR
+// below root, creating it if needed. Returns 0, or -1 with errno set.
+int encoding_init(int root, const char *codec_dir);
+
+int encoding_enabled(void);
+
+// True if an Accept-Encoding value accepts lz78.
+int encoding_accepted(const char *value);
+
+// Returns a descriptor for the compressed copy of e's file version, with its size in *size, or
+// -1 to send the file as it is. The first request for a version starts compressing it in the
+// background, so no request waits for the encoder.
+int encoding_get(CacheEntry *e, off_t *size);
+
+// Starts a decoder writing into out, which it cannot grow past ENCODING_MAX_DECODED bytes.
+// Returns the descriptor to write the encoded stream to, non-blocking if nonblock is set, with
+// the decoder's pid in *pid, or -1.
+int encoding_decoder(int out, pid_t *pid, int nonblock);
+
+// Reaps a decoder whose input has been closed, waiting for it to exit if wait is set. Returns 0
+// if it decoded a complete stream, -1 if it failed and 1 if it is still running.
+int encoding_finish(pid_t pid, int wait);
+
+// Returns a descriptor that becomes readable when child pid exits, or -1 if the kernel has none.
+int encoding_pidfd(pid_t pid);
+
+// Removes the compressed copy of path's file version old, which has just been replaced. Copies
+// of versions changed outside the server go once the current version has been compressed.
+void encoding_drop(const char *path, const struct stat *old);
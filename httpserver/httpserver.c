@@ -1,295 +1,1132 @@
-#include <assert.h>
+#define _GNU_SOURCE // accept4(), splice()
+
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
-#include <regex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <linux/limits.h>
 
 #include "asgn2_helper_funcs.h"
+#include "cache.h"
+#include "encoding.h"
+#include "request.h"
 
-#define BUFFER_SIZE 4096
+#define QUEUE_SIZE  128 // accepted connections waiting for a worker
+#define THREADS     4 // default worker count
+#define MAX_EVENTS  256 // events handled per epoll_wait
+#define IDLE_TIMEOUT 5 // default seconds a kept-alive connection may sit idle
+#define IDLE_POLL_MS 50 // how often an idle pooled connection checks for queued clients
+#define MAX_REQUESTS 100 // default requests served per connection
+#define SENDFILE_CHUNK (1 << 20) // bytes per sendfile(), so one download cannot hog a loop
+#define PIPE_CHUNK     65536 // PUT body bytes spliced per call, the default pipe capacity
+#define CACHE_MB       64 // default size of the response cache
+#define CACHE_FILES    512 // default descriptors kept open by the cache
+#define BOUNDARY       "httpserver-byteranges-5f0c3a" // separates the parts of a multi-range GET
 
-#define PARSE_REQUEST                                                                              \
-    "^([a-zA-Z]*) /([a-zA-Z.]*) (HTTP/[0-9].[0-9])\r\n(([a-zA-Z0-9.-]{0,128}: [ "                  \
-    "-~]{0,128}\r\n)+)?\r\n"
-#define PARSE_HEADER "(Content-Length): ([0-9]+)\r\n"
+// Where a connection is in its request. Every state can stop when the socket would block and
+// pick up from the same point on the next readiness event.
+typedef enum { READ_HEADERS, READ_BODY, SEND_HEADERS, SEND_FILE, DONE } State;
 
-typedef struct {
+typedef struct Conn {
+
+    int fd; // client socket
+    State state;
+    Command c;
+    int file; // PUT: temporary file being written, -1 if none
+    off_t offset; // GET: next byte to send, of body_fd or of mem
+    off_t remaining; // GET: file bytes left to send, PUT: body bytes left to receive
+    Range ranges[MAX_RANGES]; // GET: requested byte ranges, sent as parts when more than one
+    int nranges;
+    int part; // multi-range GET: next part to start, nranges for the closing boundary
+    char tmp[32]; // PUT: temporary file renamed over the target when complete
+    int pipe[2]; // PUT: socket -> pipe -> file splice, -1 until the body needs it
+    int copy; // the file refused sendfile()/splice(), so bytes go through out instead
+    CacheEntry *entry; // GET: the file, or NULL
+    const char *mem; // GET: the entry's cached response, or NULL to send from body_fd
+    int body_fd; // GET: the file, or its compressed copy
+    pid_t decoder; // PUT: decodes an lz78 body on its way from file into the temporary file
+    int pidfd; // PUT: readable once the decoder has exited, -1 if none
+    char extra[256]; // header lines the next response() adds
+    char out[BUFFER_SIZE]; // response head, then file data on its way to the socket
+    int out_len, out_pos;
+    uint32_t events; // EPOLLIN or EPOLLOUT, whichever the connection is waiting for
+    int wait_fd; // what events applies to: the socket, or a PUT's decoder pipe or pidfd
+    int ep; // event mode: the loop's epoll instance, -1 in a pool worker
+    int watched; // event mode: the one descriptor conn is registered under in ep, or -1
+    int keep_alive; // read another request after this response
+    int requests; // requests started on this connection
+    int consumed; // bytes of c.buf that belong to the current request
+    int pooled; // served by a pool worker rather than an event loop
+    uint64_t last_active; // ms timestamp of the last event, for the idle timeout
+    struct Conn *prev, *next; // event mode: the loop's connections, least recently active first
 
-    char buf[BUFFER_SIZE + 1];
-    uint16_t bufsize;
-    char command[10];
-    char location[100];
-    char version[10];
-    char headers[2048];
-    char key[200];
-    char value[200];
+} Conn;
 
-} Command;
+static atomic_ulong puts_started = 0; // numbers the PUT temporary files
+static pthread_mutex_t put_lock = PTHREAD_MUTEX_INITIALIZER; // PUT: If-Match check and rename
+static int idle_timeout = IDLE_TIMEOUT;
+static int max_requests = MAX_REQUESTS;
+static int cache_mb = CACHE_MB;
+static int cache_files = CACHE_FILES;
+static int root_fd = AT_FDCWD; // the served directory, which every path is relative to
+static mode_t put_mode = 0777; // of files a PUT creates, the umask applied
 
-void response(int val, int fd, int len) {
-    char buf[100];
-    memset(buf, '\0', sizeof(buf));
+int queue_waiting(void);
+
+uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Queues response val (with body length len for a GET) on conn and starts sending it, with
+// the header lines in conn->extra, which it then clears.
+void response(int val, Conn *conn, off_t len) {
+    const char *status = "";
+    const char *body = "";
     switch (val) {
-    case 1:
-        snprintf(buf, 100, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n", len);
-        write_n_bytes(fd, buf, strlen(buf));
-        break;
+    case 1: status = "200 OK"; break;
     case 2:
-        snprintf(buf, 100, "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nOK\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "200 OK";
+        body = "OK\n";
         break;
     case 3:
-        snprintf(buf, 100, "HTTP/1.1 201 Created\r\nContent-Length: 8\r\n\r\nCreated\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "201 Created";
+        body = "Created\n";
         break;
     case 4:
-        snprintf(buf, 100, "HTTP/1.1 404 Not Found\r\nContent-Length: 10\r\n\r\nNot Found\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "404 Not Found";
+        body = "Not Found\n";
         break;
     case 5:
-        snprintf(buf, 100, "HTTP/1.1 400 Bad Request\r\nContent-Length: 12\r\n\r\nBad Request\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "400 Bad Request";
+        body = "Bad Request\n";
         break;
     case 6:
-        snprintf(buf, 100,
-            "HTTP/1.1 501 Not Implemented\r\nContent-Length: 16\r\n\r\nNot Implemented\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "501 Not Implemented";
+        body = "Not Implemented\n";
         break;
     case 7:
-        snprintf(buf, 100,
-            "HTTP/1.1 505 Version Not Supported\r\nContent-Length: 22\r\n\r\nVersion Not "
-            "Supported\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "505 Version Not Supported";
+        body = "Version Not Supported\n";
         break;
     case 8:
-        snprintf(buf, 100,
-            "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 22\r\n\r\nInternal Server "
-            "Error\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "500 Internal Server Error";
+        body = "Internal Server Error\n";
         break;
     case 9:
-        snprintf(buf, 100, "HTTP/1.1 403 Forbidden\r\nContent-Length: 10\r\n\r\nForbidden\n");
-        write_n_bytes(fd, buf, strlen(buf));
+        status = "403 Forbidden";
+        body = "Forbidden\n";
+        break;
+    case 10: status = "206 Partial Content"; break;
+    case 11:
+        status = "416 Range Not Satisfiable";
+        body = "Range Not Satisfiable\n";
+        break;
+    case 12: status = "304 Not Modified"; break;
+    case 13:
+        status = "412 Precondition Failed";
+        body = "Precondition Failed\n";
+        break;
+    case 14:
+        status = "415 Unsupported Media Type";
+        body = "Unsupported Media Type\n";
+        break;
+    case 15:
+        status = "413 Content Too Large";
+        body = "Content Too Large\n";
         break;
     }
+    if (val != 1 && val != 10 && val != 12) {
+        len = strlen(body);
+    }
+    conn->out_len = snprintf(conn->out, sizeof(conn->out),
+        "HTTP/1.1 %s\r\nContent-Length: %jd\r\n%s%s\r\n%s", status, (intmax_t) len, conn->extra,
+        conn->keep_alive ? "" : "Connection: close\r\n", body);
+    conn->extra[0] = '\0';
+    conn->out_pos = 0;
+    conn->state = SEND_HEADERS;
 }
 
-int read_until(int fd, char *buf, int n, char str[]) {
+// Sends a cached response: the stored head and file straight from memory, in a single write
+// unless the head needs Connection: close added.
+void send_cached(Conn *conn, CacheEntry *e) {
+    conn->out_pos = 0;
+    if (conn->keep_alive) {
+        conn->out_len = 0;
+        conn->offset = 0;
+        conn->remaining = e->len;
+    } else {
+        conn->out_len = snprintf(conn->out, sizeof(conn->out), "%.*sConnection: close\r\n\r\n",
+            (int) e->head_len - 2, e->data);
+        conn->offset = e->head_len;
+        conn->remaining = e->st.st_size;
+    }
+    conn->state = SEND_FILE;
+}
 
-    int bytes_read = 0;
-    int count = 0;
-    char *check = NULL;
-    do {
-        if (bytes_read >= n) {
-            response(5, fd, 0);
-            return -1;
-        }
+// Queues file bytes first to first + len - 1 to follow whatever is in out. Send the start of
+// them with the head in one write: a separate small write would wait on the client's delayed
+// ACK, which stalls every response on a kept-alive connection. The rest goes out from the
+// cached copy or with sendfile().
+void send_body(Conn *conn, off_t first, off_t len) {
+    CacheEntry *e = conn->entry;
+    off_t room = sizeof(conn->out) - conn->out_len;
+    ssize_t n = room < len ? room : len;
+    if (conn->mem != NULL) {
+        memcpy(conn->out + conn->out_len, conn->mem + e->head_len + first, n);
+        first += e->head_len;
+    } else {
+        n = pread(conn->body_fd, conn->out + conn->out_len, n, first);
+        n = n < 0 ? 0 : n;
+    }
+    conn->out_len += n;
+    conn->offset = first + n;
+    conn->remaining = len - n;
+}
 
-        bytes_read = read(fd, buf + count, BUFFER_SIZE);
-        check = strstr(buf, str);
-        if (bytes_read < 0) {
-            response(8, fd, 0);
-            return -1;
-        } else if (bytes_read == 0) {
-            return count;
-        }
-        count += bytes_read;
+// Writes the delimiter before part i of a multi-range GET into buf (or just measures it, with
+// n 0); part nranges is the closing delimiter.
+int part_head(Conn *conn, int i, char *buf, size_t n) {
+    if (i == conn->nranges) {
+        return snprintf(buf, n, "\r\n--" BOUNDARY "--\r\n");
+    }
+    return snprintf(buf, n, "\r\n--" BOUNDARY "\r\nContent-Range: bytes %jd-%jd/%jd\r\n\r\n",
+        (intmax_t) conn->ranges[i].first, (intmax_t) conn->ranges[i].last,
+        (intmax_t) conn->entry->st.st_size);
+}
+
+// Starts the next part of a multi-range GET once the previous one is sent.
+void next_part(Conn *conn) {
+    conn->out_len = part_head(conn, conn->part, conn->out, sizeof(conn->out));
+    conn->out_pos = 0;
+    conn->remaining = 0;
+    if (conn->part < conn->nranges) {
+        Range *r = &conn->ranges[conn->part];
+        send_body(conn, r->first, r->last - r->first + 1);
+    }
+    conn->part += 1;
+    conn->state = SEND_HEADERS;
+}
+
+// Adds etag, e's Last-Modified and, when the response could have been encoded, Vary to the
+// header lines of the next response.
+void add_validators(Conn *conn, CacheEntry *e, const char *etag) {
+    size_t used = strlen(conn->extra);
+    snprintf(conn->extra + used, sizeof(conn->extra) - used,
+        "ETag: %s\r\nLast-Modified: %s\r\n%s", etag, e->modified,
+        encoding_enabled() ? "Vary: Accept-Encoding\r\n" : "");
+}
 
-    } while (check == NULL);
-    return count;
+// Writes the ETag of e's compressed copy: a representation of its own, so a cache holding
+// both never mixes them up.
+void lz_etag(char *buf, size_t n, CacheEntry *e) {
+    snprintf(buf, n, "%.*s-" ENCODING_NAME "\"", (int) strlen(e->etag) - 1, e->etag);
 }
 
-void cmd_dump(Command *c) {
+// True if the client's copy, named by If-None-Match or else If-Modified-Since, is the version
+// of e tagged etag.
+int not_modified(Command *c, CacheEntry *e, const char *etag) {
+    const char *value = cmd_header(c, "If-None-Match");
+    if (value != NULL) {
+        return cmd_etag_match(value, etag, 1);
+    }
+    value = cmd_header(c, "If-Modified-Since");
+    time_t since;
+    return value != NULL && cmd_http_date(value, &since) == 0 && e->st.st_mtime <= since;
+}
 
-    fprintf(stderr, "Command: %s, %lu\n", c->command, strlen(c->command));
-    fprintf(stderr, "Location: %s, %lu\n", c->location, strlen(c->location));
-    fprintf(stderr, "Version: %s, %lu\n", c->version, strlen(c->version));
-    fprintf(stderr, "Headers: %s, %lu\n", c->headers, strlen(c->headers));
-    fprintf(stderr, "Key: %s, %lu\n", c->key, strlen(c->key));
-    fprintf(stderr, "Value: %s, %lu\n", c->value, strlen(c->value));
+// False if If-Range names a version other than e, so the ranges would splice two versions.
+int range_current(Command *c, CacheEntry *e) {
+    const char *value = cmd_header(c, "If-Range");
+    if (value == NULL) {
+        return 1;
+    }
+    if (value[0] == '"' || strncmp(value, "W/", 2) == 0) {
+        return cmd_etag_match(value, e->etag, 0);
+    }
+    time_t date;
+    return cmd_http_date(value, &date) == 0 && date == e->st.st_mtime;
 }
 
-int get(char *filename, int dest, int file_size) {
+int get(Conn *conn) {
 
-    int fd = open(filename, O_RDONLY);
+    // usually no system call at all: the cache has the descriptor and its stat already
+    CacheEntry *e = cache_open(conn->c.location);
 
-    if (fd < 0) {
-        response(4, dest, 0);
+    if (e == NULL) {
+        response(4, conn, 0);
         return -1;
     }
-    response(1, dest, file_size);
-    pass_n_bytes(fd, dest, file_size);
 
-    close(fd);
-    return -1;
-}
+    if (S_ISDIR(e->st.st_mode)) {
+        response(9, conn, 0);
+        cache_release(e);
+        return -1;
+    }
 
-int set(char *filename, int dest, char *eoh, int remainder, int content_len) {
+    // PUTs replace the file by renaming, so this descriptor keeps seeing one whole version
+    off_t file_size = e->st.st_size;
 
-    if (access(filename, F_OK) != -1) {
-        response(2, dest, 0);
+    // The compressed copy is sent whole, so a request for ranges gets the file as it is. The
+    // copy is made in the background: until it is ready, the file goes out uncompressed.
+    const char *accept = cmd_header(&conn->c, "Accept-Encoding");
+    off_t lz_size = 0;
+    int lz_fd = -1;
+    char etag[72];
+    if (encoding_enabled() && accept != NULL && cmd_header(&conn->c, "Range") == NULL
+        && encoding_accepted(accept)) {
+        lz_fd = encoding_get(e, &lz_size);
+    }
+    if (lz_fd >= 0) {
+        lz_etag(etag, sizeof(etag), e);
     } else {
-        response(3, dest, 0);
+        snprintf(etag, sizeof(etag), "%s", e->etag);
+    }
+
+    if (not_modified(&conn->c, e, etag)) {
+        add_validators(conn, e, etag);
+        response(12, conn, lz_fd >= 0 ? lz_size : file_size);
+        cache_release(e);
+        return 0;
+    }
+
+    conn->entry = e;
+    conn->copy = 0;
+    conn->mem = NULL;
+    conn->body_fd = e->fd;
+    if (lz_fd >= 0) {
+        snprintf(conn->extra, sizeof(conn->extra), "Content-Encoding: " ENCODING_NAME "\r\n");
+        add_validators(conn, e, etag);
+        response(1, conn, lz_size);
+        conn->body_fd = lz_fd;
+        send_body(conn, 0, lz_size);
+        return 0;
+    }
+
+    conn->nranges = 0;
+    if (range_current(&conn->c, e)) {
+        conn->nranges = cmd_ranges(&conn->c, file_size, conn->ranges, MAX_RANGES);
+    }
+    if (conn->nranges < 0) {
+        conn->nranges = 0;
+        snprintf(conn->extra, sizeof(conn->extra), "Content-Range: bytes */%jd\r\n",
+            (intmax_t) file_size);
+        response(11, conn, 0);
+        conn->entry = NULL;
+        cache_release(e);
+        return -1;
+    }
+
+    conn->mem = e->data;
+    if (conn->nranges == 0) {
+        if (e->data != NULL) {
+            send_cached(conn, e);
+            return 0;
+        }
+        snprintf(conn->extra, sizeof(conn->extra), "Accept-Ranges: bytes\r\n");
+        add_validators(conn, e, etag);
+        response(1, conn, file_size);
+        send_body(conn, 0, file_size);
+
+    } else if (conn->nranges == 1) {
+        Range *r = &conn->ranges[0];
+        snprintf(conn->extra, sizeof(conn->extra), "Content-Range: bytes %jd-%jd/%jd\r\n",
+            (intmax_t) r->first, (intmax_t) r->last, (intmax_t) file_size);
+        add_validators(conn, e, etag);
+        response(10, conn, r->last - r->first + 1);
+        send_body(conn, r->first, r->last - r->first + 1);
+        conn->nranges = 0;
+
+    } else {
+        // step_send() sends the parts one after another, each from its own offset
+        off_t len = 0;
+        for (int i = 0; i <= conn->nranges; i++) {
+            len += part_head(conn, i, NULL, 0);
+            if (i < conn->nranges) {
+                len += conn->ranges[i].last - conn->ranges[i].first + 1;
+            }
+        }
+        snprintf(conn->extra, sizeof(conn->extra),
+            "Content-Type: multipart/byteranges; boundary=" BOUNDARY "\r\n");
+        add_validators(conn, e, etag);
+        response(10, conn, len);
+        conn->part = 0;
+        conn->remaining = 0;
+    }
+    return 0;
+}
+
+// The decoder stopped reading a PUT body, which it does only on bad input. The rest of the body
+// is not read, so the connection closes after the 400 the decoder's exit status leads to.
+void decoder_quit(Conn *conn) {
+    conn->keep_alive = 0;
+    conn->remaining = 0;
+    conn->out_pos = conn->out_len;
+}
+
+int set(Conn *conn) {
+
+    Command *c = &conn->c;
+
+    const char *coding = cmd_header(c, "Content-Encoding");
+    int encoded = coding != NULL && strcasecmp(coding, ENCODING_NAME) == 0;
+    if ((coding != NULL && !encoded && strcasecmp(coding, "identity") != 0)
+        || (encoded && !encoding_enabled())) {
+        snprintf(conn->extra, sizeof(conn->extra), "Accept-Encoding: %s\r\n",
+            encoding_enabled() ? ENCODING_NAME : "identity");
+        conn->keep_alive = 0;
+        response(14, conn, 0);
+        return -1;
     }
-    int fd = open(filename, O_CREAT | O_RDWR | O_TRUNC, 0777);
+
+    // The body goes to a temporary file that replaces the target only once it is complete, so
+    // a GET never sees a half-written file and never has to wait for a slow upload. Request
+    // paths cannot contain digits, so the name cannot clash with a served file.
+    snprintf(conn->tmp, sizeof(conn->tmp), ".put-%d-%lu", getpid(),
+        atomic_fetch_add(&puts_started, 1));
+    int fd = openat(root_fd, conn->tmp, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0777);
 
     if (fd < 0) {
-        response(8, dest, 0);
+        conn->tmp[0] = '\0';
+        conn->keep_alive = 0; // the body is still in the way of the next request
+        response(8, conn, 0);
         return -1;
     }
+    conn->file = fd;
+    conn->copy = 0;
 
-    if (content_len <= remainder) {
-        write_n_bytes(fd, eoh + 4, content_len);
-        close(fd);
-        return 0;
-    } else if (content_len > remainder) {
-        write_n_bytes(fd, eoh + 4, remainder);
-        pass_n_bytes(dest, fd, content_len - remainder);
+    // An encoded body is written to a decoder, which writes the file. Its pipe does not block
+    // an event loop, and the body goes through out, where what the pipe has no room for waits.
+    if (encoded) {
+        conn->file = encoding_decoder(fd, &conn->decoder, !conn->pooled);
         close(fd);
-        return 0;
+        if (conn->file < 0) {
+            conn->decoder = 0;
+            unlinkat(root_fd, conn->tmp, 0);
+            conn->tmp[0] = '\0';
+            conn->keep_alive = 0;
+            response(8, conn, 0);
+            return -1;
+        }
+        conn->copy = 1;
     }
-    close(fd);
+
+    long remainder = c->bufsize - c->head_len;
+    long content_len = c->content_length < 0 ? 0 : c->content_length;
+
+    // whatever follows the body in buf is the next pipelined request; the body bytes before it
+    // wait in out for step_read_body()
+    long first = content_len < remainder ? content_len : remainder;
+    memcpy(conn->out, c->buf + c->head_len, first);
+    conn->out_len = first;
+    conn->out_pos = 0;
+    conn->consumed = c->head_len + first;
+    conn->remaining = content_len - first;
+    conn->state = READ_BODY;
     return 0;
 }
 
-int cmd_parse(Command *c, int fd) {
+void conn_init(Conn *conn, int fd) {
+    conn->fd = fd;
+    conn->state = READ_HEADERS;
+    conn->c.bufsize = 0;
+    conn->c.scanned = 0;
+    conn->c.buf[0] = '\0';
+    conn->file = -1;
+    conn->tmp[0] = '\0';
+    conn->pipe[0] = conn->pipe[1] = -1;
+    conn->entry = NULL;
+    conn->mem = NULL;
+    conn->body_fd = -1;
+    conn->decoder = 0;
+    conn->pidfd = -1;
+    conn->nranges = 0;
+    conn->extra[0] = '\0';
+    conn->events = EPOLLIN;
+    conn->wait_fd = fd;
+    conn->ep = -1;
+    conn->watched = -1;
+    conn->keep_alive = 1;
+    conn->requests = 0;
+    conn->consumed = 0;
+    conn->pooled = 0;
+    conn->last_active = now_ms();
 
-    memset(c->buf, '\0', sizeof(c->buf));
-    memset(c->command, '\0', sizeof(c->command));
-    memset(c->location, '\0', sizeof(c->location));
-    memset(c->version, '\0', sizeof(c->version));
-    memset(c->headers, '\0', sizeof(c->headers));
-    memset(c->key, '\0', sizeof(c->key));
-    memset(c->value, '\0', sizeof(c->value));
+    // responses are written whole, so there is nothing for Nagle's algorithm to coalesce
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
 
-    regex_t re;
-    regmatch_t first_matches[5];
-    int rc;
-    regmatch_t second_matches[3];
-    int match_len = 0;
+// Event mode: registers conn in its loop's epoll instance under wait_fd for events. It is in
+// there under one descriptor at a time, so one epoll_wait() never returns it twice. Returns 0,
+// or -1 if it could not be registered.
+int conn_watch(Conn *conn) {
+    struct epoll_event ev = { .events = conn->events, .data.ptr = conn };
+    if (conn->watched == conn->wait_fd) {
+        return epoll_ctl(conn->ep, EPOLL_CTL_MOD, conn->wait_fd, &ev);
+    }
+    if (conn->watched >= 0) {
+        epoll_ctl(conn->ep, EPOLL_CTL_DEL, conn->watched, NULL);
+        conn->watched = -1;
+    }
+    if (epoll_ctl(conn->ep, EPOLL_CTL_ADD, conn->wait_fd, &ev) < 0) {
+        return -1;
+    }
+    conn->watched = conn->wait_fd;
+    return 0;
+}
 
-    c->bufsize = read_until(fd, c->buf, BUFFER_SIZE, "\r\n\r\n");
-    if (c->bufsize > 0) {
+// Takes fd out of the epoll instance before it is closed. A child being spawned can briefly
+// hold a copy of it, which would otherwise keep the registration alive.
+void conn_unwatch(Conn *conn, int fd) {
+    if (conn->ep >= 0 && fd >= 0 && conn->watched == fd) {
+        epoll_ctl(conn->ep, EPOLL_CTL_DEL, fd, NULL);
+        conn->watched = -1;
+    }
+}
 
-        c->buf[c->bufsize] = '\0';
+// Closes the socket and anything the request left open; an unfinished PUT is discarded.
+void conn_close(Conn *conn) {
+    conn_unwatch(conn, conn->watched);
+    if (conn->file >= 0) {
+        close(conn->file);
+    }
+    if (conn->decoder > 0) {
+        kill(conn->decoder, SIGKILL);
+        encoding_finish(conn->decoder, 1);
+    }
+    if (conn->pidfd >= 0) {
+        close(conn->pidfd);
+    }
+    if (conn->tmp[0] != '\0') {
+        unlinkat(root_fd, conn->tmp, 0);
+    }
+    if (conn->pipe[0] >= 0) {
+        close(conn->pipe[0]);
+        close(conn->pipe[1]);
+    }
+    if (conn->entry != NULL) {
+        cache_release(conn->entry);
+    }
+    close(conn->fd);
+}
 
-        rc = regcomp(&re, PARSE_REQUEST, REG_EXTENDED);
-        assert(!rc);
+// Waits for the next request on a pooled kept-alive connection, in short polls so that a client
+// queued in the meantime is noticed rather than left behind a blocking read(). Returns 1 once
+// fd is readable, or 0 if clients are waiting for a worker or the idle timeout ran out.
+int idle_wait(int fd) {
+    uint64_t deadline = now_ms() + (uint64_t) idle_timeout * 1000;
+    while (!queue_waiting()) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, IDLE_POLL_MS);
+        if (ready > 0) {
+            return 1;
+        }
+        if ((ready < 0 && errno != EINTR) || now_ms() >= deadline) {
+            return 0;
+        }
+    }
+    return 0;
+}
 
-        rc = regexec(&re, (char *) c->buf, 5, first_matches, 0);
+// Each step returns 1 after making progress, 0 when the socket would block (conn->events says
+// on what) and -1 when the connection should be closed.
+int step_read_headers(Conn *conn) {
+    Command *c = &conn->c;
 
-        if (rc == 0) {
-            match_len = first_matches[1].rm_eo - first_matches[1].rm_so;
-            strncpy(c->command, c->buf + first_matches[1].rm_so, match_len);
-            c->command[match_len] = '\0';
+    if (cmd_head_end(c) == 0) {
+        if (c->bufsize == BUFFER_SIZE) {
+            conn->keep_alive = 0;
+            response(5, conn, 0); // the head does not fit the buffer
+            return 1;
+        }
+        if (c->bufsize == 0 && conn->pooled && conn->requests > 0 && !idle_wait(conn->fd)) {
+            return -1; // idle between requests while other clients wait for a worker
+        }
 
-            match_len = first_matches[2].rm_eo - first_matches[2].rm_so;
-            strncpy(c->location, c->buf + first_matches[2].rm_so, match_len);
-            c->location[match_len] = '\0';
+        ssize_t bytes_read = read(conn->fd, c->buf + c->bufsize, BUFFER_SIZE - c->bufsize);
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->events = EPOLLIN;
+                return 0;
+            }
+            return -1;
+        } else if (bytes_read == 0) {
+            if (c->bufsize == 0) {
+                return -1; // closed between requests
+            }
+            conn->keep_alive = 0;
+            response(5, conn, 0);
+            return 1;
+        }
+        c->bufsize += bytes_read;
+        c->buf[c->bufsize] = '\0';
+        return 1;
+    }
 
-            match_len = first_matches[3].rm_eo - first_matches[3].rm_so;
-            strncpy(c->version, c->buf + first_matches[3].rm_so, match_len);
-            c->version[match_len] = '\0';
+    c->head_len = c->scanned;
+    conn->consumed = c->head_len;
+    conn->requests += 1;
+    int val = cmd_parse(c);
+    conn->keep_alive = c->keep_alive && conn->requests < max_requests;
+    if (val != 0) {
+        conn->keep_alive = 0; // no telling where the next request would start
+        response(val, conn, 0);
+    } else if (strcmp(c->command, "GET") == 0) {
+        get(conn);
+    } else {
+        set(conn);
+    }
+    return 1;
+}
 
-            match_len = first_matches[4].rm_eo - first_matches[4].rm_so;
-            strncpy(c->headers, c->buf + first_matches[4].rm_so, match_len);
-            c->headers[match_len] = '\0';
+// Moves up to PIPE_CHUNK body bytes socket -> pipe -> file, so they never enter user space.
+// Returns the bytes stored, 0 at end of input, or -1 with errno set; EINVAL or ENOSYS mean
+// nothing was moved and the plain copy has to be used.
+ssize_t body_splice(Conn *conn) {
+    if (conn->pipe[0] < 0 && pipe2(conn->pipe, O_CLOEXEC) < 0) {
+        errno = ENOSYS; // out of descriptors for the pipe, copy instead
+        return -1;
+    }
 
-            if (strcmp(c->command, "GET") != 0 && strcmp(c->command, "PUT") != 0) {
-                response(6, fd, 0);
-                return -1;
+    size_t want = conn->remaining < PIPE_CHUNK ? conn->remaining : PIPE_CHUNK;
+    ssize_t in = splice(conn->fd, NULL, conn->pipe[1], NULL, want, SPLICE_F_MOVE);
+    if (in <= 0) {
+        return in;
+    }
 
-            } else if (strcmp(c->version, "HTTP/1.1") != 0) {
-                response(7, fd, 0);
+    // the pipe is always drained, so the next call starts with it empty
+    ssize_t left = in;
+    while (left > 0) {
+        ssize_t out = splice(conn->pipe[0], NULL, conn->file, NULL, left, SPLICE_F_MOVE);
+        if (out > 0) {
+            left -= out;
+            continue;
+        }
+        if (out < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            conn->copy = 1; // the filesystem cannot take a splice; empty the pipe by hand
+        }
+        while (left > 0) {
+            ssize_t r = read(conn->pipe[0], conn->out, left < BUFFER_SIZE ? left : BUFFER_SIZE);
+            if (r <= 0) {
+                errno = EIO;
                 return -1;
             }
-
-        } else {
-            if (strlen(c->command) == 0) {
-                response(5, fd, 0);
+            if (write_n_bytes(conn->file, conn->out, r) < 0) {
                 return -1;
+            }
+            left -= r;
+        }
+    }
+    return in;
+}
 
-            } else if (strlen(c->location) == 0) {
-                response(5, fd, 0);
-                return -1;
+// Reads up to BUFFER_SIZE body bytes into conn->out, which step_read_body() writes to the file.
+ssize_t body_copy(Conn *conn) {
+    size_t want = conn->remaining < BUFFER_SIZE ? conn->remaining : BUFFER_SIZE;
+    ssize_t bytes_read = read(conn->fd, conn->out, want);
+    if (bytes_read > 0) {
+        conn->out_len = bytes_read;
+        conn->out_pos = 0;
+    }
+    return bytes_read;
+}
 
-            } else if (strlen(c->version) == 0) {
-                response(5, fd, 0);
-                return -1;
+int step_read_body(Conn *conn) {
+    // body bytes already read go first; a decoder's pipe may have had no room for them
+    if (conn->out_pos < conn->out_len) {
+        ssize_t n = write(conn->file, conn->out + conn->out_pos, conn->out_len - conn->out_pos);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->wait_fd = conn->file;
+                conn->events = EPOLLOUT;
+                return 0;
+            }
+            if (errno == EINTR) {
+                return 1;
+            }
+            if (errno == EPIPE && conn->decoder > 0) {
+                decoder_quit(conn);
+                return 1;
             }
+            return -1;
         }
-        regfree(&re);
-        rc = regcomp(&re, PARSE_HEADER, REG_EXTENDED);
-        assert(!rc);
+        conn->out_pos += n;
+        return 1;
+    }
 
-        rc = regexec(&re, c->headers, 3, second_matches, 0);
+    if (conn->remaining > 0) {
+        ssize_t n = conn->copy ? body_copy(conn) : body_splice(conn);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn->events = EPOLLIN;
+                return 0;
+            }
+            if (!conn->copy && (errno == EINVAL || errno == ENOSYS)) {
+                conn->copy = 1;
+                return 1;
+            }
+            if (errno == EPIPE && conn->decoder > 0) {
+                decoder_quit(conn);
+                return 1;
+            }
+            return -1;
+        }
+        if (n > 0) {
+            conn->remaining -= n;
+            return 1;
+        }
+        // the client sent less than Content-Length: store what arrived
+    }
 
-        if (rc == 0) {
+    // pipes are only held while a body is streaming in, which bounds descriptors per loop
+    if (conn->pipe[0] >= 0) {
+        close(conn->pipe[0]);
+        close(conn->pipe[1]);
+        conn->pipe[0] = conn->pipe[1] = -1;
+    }
+    if (conn->file >= 0) {
+        conn_unwatch(conn, conn->file);
+        close(conn->file);
+        conn->file = -1;
+    }
 
-            match_len = second_matches[1].rm_eo - second_matches[1].rm_so;
-            strncpy(c->key, c->headers + second_matches[1].rm_so, match_len);
-            c->key[match_len] = '\0';
+    // The decoder has seen the end of its input; it fails on a corrupt or truncated stream. An
+    // event loop waits for its exit on a pidfd rather than in waitpid().
+    struct stat st;
+    if (conn->decoder > 0) {
+        int decoded = encoding_finish(conn->decoder, conn->pooled);
+        if (decoded > 0 && conn->pidfd < 0) {
+            conn->pidfd = encoding_pidfd(conn->decoder);
+        }
+        if (decoded > 0 && conn->pidfd >= 0) {
+            conn->wait_fd = conn->pidfd;
+            conn->events = EPOLLIN;
+            return 0;
+        }
+        if (decoded > 0) {
+            decoded = encoding_finish(conn->decoder, 1); // no pidfd to wait on
+        }
+        if (conn->pidfd >= 0) {
+            conn_unwatch(conn, conn->pidfd);
+            close(conn->pidfd);
+            conn->pidfd = -1;
+        }
+        conn->decoder = 0;
 
-            match_len = second_matches[2].rm_eo - second_matches[2].rm_so;
-            strncpy(c->value, c->headers + second_matches[2].rm_so, match_len);
-            c->value[match_len] = '\0';
+        // decode gives the file the permissions recorded in the stream, not those of a PUT
+        if (decoded != 0 || fchmodat(root_fd, conn->tmp, put_mode, 0) < 0) {
+            // a decoder stopped at ENCODING_MAX_DECODED leaves a file of exactly that size
+            int full = decoded != 0 && fstatat(root_fd, conn->tmp, &st, 0) == 0
+                       && st.st_size >= ENCODING_MAX_DECODED;
+            unlinkat(root_fd, conn->tmp, 0);
+            conn->tmp[0] = '\0';
+            response(full ? 15 : 5, conn, 0);
+            return 1;
         }
-        regfree(&re);
+    }
+    fstatat(root_fd, conn->tmp, &st, 0); // the new version's ETag goes back to the client
 
-        if (strcmp(c->command, "GET") == 0) {
+    // The If-Match check and the rename happen under one lock, so the version that matched is
+    // the version replaced
+    pthread_mutex_lock(&put_lock);
+    struct stat old;
+    int exists = fstatat(root_fd, conn->c.location, &old, 0) == 0;
+    int status = exists ? 2 : 3;
+    const char *match = cmd_header(&conn->c, "If-Match");
+    if (match != NULL) {
+        char etag[64];
+        if (exists) {
+            cache_etag(etag, sizeof(etag), &old);
+        }
+        if (!exists || !cmd_etag_match(match, etag, 0)) {
+            status = 13;
+        }
+    }
+    // a replaced file keeps its permission bits, and its owner where we are allowed to set it
+    if (status != 13 && exists) {
+        fchownat(root_fd, conn->tmp, old.st_uid, old.st_gid, 0);
+        fchmodat(root_fd, conn->tmp, old.st_mode & 07777, 0);
+    }
+    if (status != 13 && renameat(root_fd, conn->tmp, root_fd, conn->c.location) < 0) {
+        status = 8;
+    }
+    pthread_mutex_unlock(&put_lock);
+
+    if (status != 2 && status != 3) {
+        unlinkat(root_fd, conn->tmp, 0);
+        conn->tmp[0] = '\0';
+        response(status, conn, 0);
+        return 1;
+    }
+    conn->tmp[0] = '\0';
+    cache_invalidate(conn->c.location);
+    if (status == 2) {
+        encoding_drop(conn->c.location, &old);
+    }
+    char etag[64];
+    cache_etag(etag, sizeof(etag), &st);
+    snprintf(conn->extra, sizeof(conn->extra), "ETag: %s\r\n", etag);
+    response(status, conn, 0);
+    return 1;
+}
+
+// Moves on to the next request after a response has gone out, keeping any bytes of it that
+// were already read. Returns 1 to carry on, or -1 to close the connection.
+int conn_next(Conn *conn) {
+    Command *c = &conn->c;
+    if (conn->entry != NULL) {
+        cache_release(conn->entry);
+        conn->entry = NULL;
+    }
+    conn->nranges = 0;
+    if (!conn->keep_alive) {
+        return -1;
+    }
+    c->bufsize -= conn->consumed;
+    memmove(c->buf, c->buf + conn->consumed, c->bufsize);
+    c->buf[c->bufsize] = '\0';
+    c->scanned = 0;
+    conn->consumed = 0;
+    conn->state = READ_HEADERS;
+    return 1;
+}
 
-            struct stat fileStat;
-            stat(c->location, &fileStat);
+int step_send(Conn *conn) {
+    if (conn->out_pos == conn->out_len) {
+        if (conn->remaining == 0 && conn->nranges > 0 && conn->part <= conn->nranges) {
+            next_part(conn);
+            return 1;
+        }
+        if (conn->state == SEND_HEADERS && conn->entry != NULL && conn->remaining > 0) {
+            conn->state = SEND_FILE;
+        }
+        if (conn->state != SEND_FILE || conn->remaining == 0) {
+            conn->state = DONE;
+            return conn_next(conn);
+        }
 
-            if (S_ISDIR(fileStat.st_mode)) {
-                response(9, fd, 0);
+        if (conn->mem != NULL) {
+            ssize_t n = write(conn->fd, conn->mem + conn->offset, conn->remaining);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    conn->events = EPOLLOUT;
+                    return 0;
+                }
                 return -1;
             }
+            conn->offset += n;
+            conn->remaining -= n;
+            return 1;
+        }
 
-            int file_size = fileStat.st_size;
-            get(c->location, fd, file_size);
+        if (!conn->copy) {
+            size_t want = conn->remaining < SENDFILE_CHUNK ? conn->remaining : SENDFILE_CHUNK;
+            ssize_t n = sendfile(conn->fd, conn->body_fd, &conn->offset, want);
+            if (n > 0) {
+                conn->remaining -= n;
+                return 1;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                conn->events = EPOLLOUT;
+                return 0;
+            }
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                conn->copy = 1; // the filesystem cannot sendfile(); copy through out
+                return 1;
+            }
+            return -1; // error, or the file shrank under us
+        }
 
-        } else if (strcmp(c->command, "PUT") == 0) {
+        size_t want = conn->remaining < BUFFER_SIZE ? conn->remaining : BUFFER_SIZE;
+        ssize_t n = pread(conn->body_fd, conn->out, want, conn->offset);
+        if (n <= 0) {
+            return -1; // the file shrank under us
+        }
+        conn->offset += n;
+        conn->remaining -= n;
+        conn->out_len = n;
+        conn->out_pos = 0;
+    }
 
-            char *filename = c->location;
-            char *eoh = strstr(c->buf, "\r\n\r\n");
-            if (eoh == NULL) {
-                response(5, fd, 0);
-                return -1;
+    ssize_t written = write(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos);
+    if (written < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn->events = EPOLLOUT;
+            return 0;
+        }
+        return -1;
+    }
+    conn->out_pos += written;
+    return 1;
+}
+
+// Advances conn as far as its socket allows. Returns 0 to wait for conn->events on
+// conn->wait_fd, -1 to close.
+int conn_run(Conn *conn) {
+    int rc = 1;
+    while (rc > 0) {
+        conn->wait_fd = conn->fd; // unless the step waits on a decoder instead
+        switch (conn->state) {
+        case READ_HEADERS: rc = step_read_headers(conn); break;
+        case READ_BODY: rc = step_read_body(conn); break;
+        case SEND_HEADERS:
+        case SEND_FILE: rc = step_send(conn); break;
+        case DONE: rc = -1; break;
+        }
+    }
+    return rc;
+}
+
+// Accepted connections waiting for a worker. The dispatcher blocks while it is full, so a
+// burst of clients waits in the kernel's listen backlog instead of being dropped.
+typedef struct {
+    int fds[QUEUE_SIZE];
+    int head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} Queue;
+
+static Queue queue = { .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER };
+
+void queue_push(int fd) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == QUEUE_SIZE) {
+        pthread_cond_wait(&queue.not_full, &queue.lock);
+    }
+    queue.fds[(queue.head + queue.count) % QUEUE_SIZE] = fd;
+    queue.count += 1;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+}
+
+// True if connections are waiting for a worker.
+int queue_waiting(void) {
+    pthread_mutex_lock(&queue.lock);
+    int waiting = queue.count > 0;
+    pthread_mutex_unlock(&queue.lock);
+    return waiting;
+}
+
+int queue_pop(void) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0) {
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    }
+    int fd = queue.fds[queue.head];
+    queue.head = (queue.head + 1) % QUEUE_SIZE;
+    queue.count -= 1;
+    pthread_cond_signal(&queue.not_full);
+    pthread_mutex_unlock(&queue.lock);
+    return fd;
+}
+
+// Each worker serves one connection at a time with its own Conn. The sockets are blocking with
+// the idle timeout as their receive and send timeouts, so conn_run() only stops early on a
+// timeout, and a client that stops reading cannot hold its worker for good. A kept-alive
+// connection gives up its worker when it goes idle while others are queued.
+void *worker(void *arg) {
+    (void) arg;
+    Conn *conn = malloc(sizeof(Conn));
+    if (conn == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+
+    struct timeval tv = { .tv_sec = idle_timeout, .tv_usec = 0 };
+    while (1) {
+        conn_init(conn, queue_pop());
+        conn->pooled = 1;
+        setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        conn_run(conn);
+        conn_close(conn);
+    }
+    return NULL;
+}
+
+// An event loop's connections in order of last activity, so the idle ones are at the front.
+typedef struct {
+    Conn *head, *tail;
+} ConnList;
+
+void list_remove(ConnList *list, Conn *conn) {
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        list->head = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    } else {
+        list->tail = conn->prev;
+    }
+}
+
+void list_append(ConnList *list, Conn *conn) {
+    conn->last_active = now_ms();
+    conn->prev = list->tail;
+    conn->next = NULL;
+    if (list->tail != NULL) {
+        list->tail->next = conn;
+    } else {
+        list->head = conn;
+    }
+    list->tail = conn;
+}
+
+// Event mode: each loop thread owns an epoll instance and every connection it accepts, and
+// drives them all through conn_run() on non-blocking sockets. The listener is in every
+// instance with EPOLLEXCLUSIVE, so a new connection wakes one loop rather than all of them.
+void *event_loop(void *arg) {
+    int listen_fd = *(int *) arg;
+    int ep = epoll_create1(0);
+    if (ep < 0) {
+        err(EXIT_FAILURE, "epoll_create1");
+    }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        err(EXIT_FAILURE, "epoll_ctl");
+    }
+
+    ConnList active = { NULL, NULL };
+    uint64_t idle_ms = idle_timeout * 1000;
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        // sleep no longer than until the least recently active connection times out
+        int wait_ms = -1;
+        if (active.head != NULL) {
+            uint64_t now = now_ms();
+            uint64_t expires = active.head->last_active + idle_ms;
+            wait_ms = expires > now ? expires - now : 0;
+        }
+        int n = epoll_wait(ep, events, MAX_EVENTS, wait_ms);
+        for (int i = 0; i < n; i++) {
+            Conn *conn = events[i].data.ptr;
+
+            if (conn == NULL) {
+                int fd;
+                while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    conn = malloc(sizeof(Conn));
+                    if (conn == NULL) {
+                        close(fd);
+                        continue;
+                    }
+                    conn_init(conn, fd);
+                    conn->ep = ep;
+                    if (conn_watch(conn) < 0) {
+                        close(fd);
+                        free(conn);
+                        continue;
+                    }
+                    list_append(&active, conn);
+                }
+                continue;
             }
 
-            int bytes_processed = strlen(c->command) + strlen(c->location) + strlen(c->version)
-                                  + strlen(c->headers) + 7;
-            int to_write = c->bufsize - bytes_processed;
-            char *ptr;
-            long content_len = strtoul(c->value, &ptr, 10);
-            set(filename, fd, eoh, to_write, content_len);
+            uint32_t waiting = conn->events;
+            list_remove(&active, conn);
+            if (conn_run(conn) < 0
+                || ((conn->events != waiting || conn->watched != conn->wait_fd)
+                    && conn_watch(conn) < 0)) {
+                conn_close(conn);
+                free(conn);
+                continue;
+            }
+            list_append(&active, conn);
+        }
+
+        uint64_t now = now_ms();
+        while (active.head != NULL && active.head->last_active + idle_ms <= now) {
+            Conn *idle = active.head;
+            list_remove(&active, idle);
+            conn_close(idle);
+            free(idle);
         }
     }
-    return 0;
+    return NULL;
+}
+
+// Prints the cache counters to stderr on every SIGUSR1, which the other threads block.
+void *stats_reporter(void *arg) {
+    sigset_t *set = arg;
+    int sig;
+    while (sigwait(set, &sig) == 0) {
+        CacheStats st;
+        cache_stats(&st);
+        fprintf(stderr,
+            "cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions, %" PRIu64
+            " entries, %" PRIu64 " bytes\n",
+            st.hits, st.misses, st.evictions, st.entries, st.bytes);
+    }
+    return NULL;
 }
 
 int main(int argc, char *argv[]) {
 
-    if (argc != 2) {
+    int opt = 0;
+    int threads = THREADS;
+    int event_mode = 0;
+    const char *codec_dir = NULL;
+    while ((opt = getopt(argc, argv, "t:ei:k:c:f:z:")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'e': event_mode = 1; break;
+        case 'i': idle_timeout = atoi(optarg); break;
+        case 'k': max_requests = atoi(optarg); break;
+        case 'c': cache_mb = atoi(optarg); break;
+        case 'f': cache_files = atoi(optarg); break;
+        case 'z': codec_dir = optarg; break;
+        default:
+            fprintf(stderr,
+                "Usage: %s [-e] [-t threads] [-i idle_seconds] [-k requests] [-c cache_mb] "
+                "[-f files] [-z codec_dir] <port>\n",
+                argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (threads < 1) {
+        fprintf(stderr, "Invalid Thread Count\n");
+        exit(EXIT_FAILURE);
+    }
+    if (idle_timeout < 1 || max_requests < 1) {
+        fprintf(stderr, "Invalid Keep-Alive Limits\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cache_mb < 0 || cache_files < 0) {
+        fprintf(stderr, "Invalid Cache Size\n");
+        exit(EXIT_FAILURE);
+    }
+    if (optind != argc - 1) {
         fprintf(stderr, "Invalid Port\n");
         exit(EXIT_FAILURE);
     }
-    int port = atoi(argv[1]);
-
-    Command c;
-    (void) c;
+    int port = atoi(argv[optind]);
 
     Listener_Socket socket;
     int valid = listener_init(&socket, port);
@@ -298,12 +1135,70 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // a client that hangs up mid-response must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    root_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        err(EXIT_FAILURE, "open");
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    put_mode = 0777 & ~mask;
+
+    if (codec_dir != NULL && encoding_init(root_fd, codec_dir) < 0) {
+        err(EXIT_FAILURE, "%s", codec_dir);
+    }
+    cache_init(root_fd, (size_t) cache_mb << 20, cache_files,
+        encoding_enabled() ? "Vary: Accept-Encoding\r\n" : "");
+    static sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &usr1, NULL); // inherited by every thread started below
+    pthread_t stats_tid;
+    if (pthread_create(&stats_tid, NULL, stats_reporter, &usr1) != 0) {
+        err(EXIT_FAILURE, "pthread_create");
+    }
+    pthread_detach(stats_tid);
+
+    if (event_mode) {
+        // listener_accept() only does blocking accepts, so the event loops use the listening
+        // socket directly, with the longest backlog and as many descriptors as allowed
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        listen(socket.fd, SOMAXCONN);
+        fcntl(socket.fd, F_SETFL, fcntl(socket.fd, F_GETFL) | O_NONBLOCK);
+
+        for (int i = 1; i < threads; i++) {
+            pthread_t tid;
+            if (pthread_create(&tid, NULL, event_loop, &socket.fd) != 0) {
+                err(EXIT_FAILURE, "pthread_create");
+            }
+            pthread_detach(tid);
+        }
+        event_loop(&socket.fd);
+        return 0;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, NULL) != 0) {
+            err(EXIT_FAILURE, "pthread_create");
+        }
+        pthread_detach(tid);
+    }
+
     int socket_fd = 0;
 
     while (1) {
         socket_fd = listener_accept(&socket);
-        cmd_parse(&c, socket_fd);
-        close(socket_fd);
+        if (socket_fd < 0) {
+            continue;
+        }
+        queue_push(socket_fd);
     }
     return 0;
 }
@@ -0,0 +1,263 @@
+#define _GNU_SOURCE // strcasestr(), strptime(), timegm()
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "request.h"
+
+int cmd_head_end(Command *c) {
+
+    // the blank line may straddle the previous read, so back up over a partial "\r\n\r"
+    int from = c->scanned > 3 ? c->scanned - 3 : 0;
+    char *end = c->buf + c->bufsize;
+    char *p = c->buf + from;
+
+    // memchr() is vectorized in libc, so only the line ends are looked at one by one
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        if (p - c->buf >= 3 && p[-1] == '\r' && p[-2] == '\n' && p[-3] == '\r') {
+            c->scanned = p + 1 - c->buf;
+            return c->scanned;
+        }
+        p++;
+    }
+    c->scanned = c->bufsize;
+    return 0;
+}
+
+// Characters of a header name, as the old request pattern allowed.
+static int is_name_char(char ch) {
+    return isalnum((unsigned char) ch) || ch == '-' || ch == '.';
+}
+
+int cmd_parse(Command *c) {
+
+    char *p = c->buf;
+    c->nheaders = 0;
+    c->content_length = -1;
+    c->keep_alive = 0;
+
+    // Request line: <method> /<location> HTTP/<d>.<d>
+    c->command = p;
+    while (isalpha((unsigned char) *p)) {
+        p++;
+    }
+    if (p[0] != ' ' || p[1] != '/') {
+        return 5;
+    }
+    *p = '\0';
+    p += 2;
+
+    c->location = p;
+    while (isalpha((unsigned char) *p) || *p == '.') {
+        p++;
+    }
+    if (*p != ' ') {
+        return 5;
+    }
+    *p++ = '\0';
+
+    c->version = p;
+    if (strncmp(p, "HTTP/", 5) != 0 || !isdigit((unsigned char) p[5])
+        || !isdigit((unsigned char) p[7]) || p[8] != '\r' || p[9] != '\n') {
+        return 5;
+    }
+    p[8] = '\0';
+    p += 10;
+
+    // Header lines up to the blank line; the head is known to end in "\r\n\r\n"
+    while (*p != '\r') {
+        char *name = p;
+        while (is_name_char(*p)) {
+            p++;
+        }
+        if (p == name || *p != ':') {
+            return 5;
+        }
+        *p++ = '\0';
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        char *value = p;
+        while ((*p >= ' ' && *p <= '~') || *p == '\t') {
+            p++;
+        }
+        if (p[0] != '\r' || p[1] != '\n') {
+            return 5;
+        }
+        char *trim = p;
+        while (trim > value && (trim[-1] == ' ' || trim[-1] == '\t')) {
+            trim--;
+        }
+        *trim = '\0';
+        p += 2;
+
+        if (c->nheaders == MAX_HEADERS) {
+            return 5;
+        }
+        c->headers[c->nheaders].name = name;
+        c->headers[c->nheaders].value = value;
+        c->nheaders += 1;
+    }
+    if (p[1] != '\n') {
+        return 5;
+    }
+
+    if (strcmp(c->command, "GET") != 0 && strcmp(c->command, "PUT") != 0) {
+        return 6;
+
+    } else if (strcmp(c->version, "HTTP/1.1") != 0) {
+        return 7;
+    }
+
+    const char *value = cmd_header(c, "Content-Length");
+    if (value != NULL) {
+        char *ptr;
+        c->content_length = strtol(value, &ptr, 10);
+        if (!isdigit((unsigned char) value[0]) || *ptr != '\0') {
+            return 5;
+        }
+    }
+
+    // HTTP/1.1 connections stay open unless the client says otherwise
+    value = cmd_header(c, "Connection");
+    c->keep_alive = value == NULL || strcasestr(value, "close") == NULL;
+    return 0;
+}
+
+const char *cmd_header(Command *c, const char *name) {
+
+    for (int i = 0; i < c->nheaders; i++) {
+        if (strcasecmp(c->headers[i].name, name) == 0) {
+            return c->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+// Reads a decimal byte position at *p, at most 18 digits so it cannot overflow.
+static off_t read_pos(const char **p) {
+    off_t n = 0;
+    int digits = 0;
+    while (isdigit((unsigned char) **p) && digits < 19) {
+        n = n * 10 + (**p - '0');
+        (*p)++;
+        digits++;
+    }
+    return digits == 0 || digits > 18 ? -1 : n;
+}
+
+int cmd_ranges(Command *c, off_t size, Range *ranges, int max) {
+
+    const char *p = cmd_header(c, "Range");
+    if (p == NULL || strncasecmp(p, "bytes=", 6) != 0) {
+        return 0;
+    }
+    p += 6;
+
+    // bytes=<first>-[<last>] or bytes=-<suffix length>, comma separated
+    int n = 0, asked = 0;
+    while (1) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        off_t first, last;
+        if (*p == '-') {
+            p++;
+            off_t suffix = read_pos(&p);
+            if (suffix < 0) {
+                return 0;
+            }
+            first = suffix < size ? size - suffix : 0;
+            last = suffix > 0 ? size - 1 : -1;
+        } else {
+            first = read_pos(&p);
+            if (first < 0 || *p++ != '-') {
+                return 0;
+            }
+            last = size - 1;
+            if (isdigit((unsigned char) *p)) {
+                last = read_pos(&p);
+                if (last < first) {
+                    return 0;
+                }
+                if (last >= size) {
+                    last = size - 1;
+                }
+            }
+        }
+        if (++asked > max) {
+            return 0;
+        }
+        if (first <= last) {
+            ranges[n].first = first;
+            ranges[n].last = last;
+            n++;
+        }
+
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (*p++ != ',') {
+            return 0;
+        }
+    }
+    return n > 0 ? n : -1;
+}
+
+int cmd_etag_match(const char *value, const char *etag, int weak) {
+
+    size_t len = strlen(etag);
+    const char *p = value;
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        if (*p == '*') {
+            return 1;
+        }
+        int is_weak = strncmp(p, "W/", 2) == 0;
+        if (is_weak) {
+            p += 2;
+        }
+        if (*p != '"') {
+            return 0; // malformed: nothing matches
+        }
+        const char *end = strchr(p + 1, '"');
+        if (end == NULL) {
+            return 0;
+        }
+        if ((weak || !is_weak) && (size_t) (end + 1 - p) == len && strncmp(p, etag, len) == 0) {
+            return 1;
+        }
+        p = end + 1;
+    }
+    return 0;
+}
+
+int cmd_http_date(const char *value, time_t *t) {
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || *end != '\0') {
+        return -1;
+    }
+    *t = timegm(&tm);
+    return 0;
+}
+
+void cmd_dump(Command *c) {
+
+    fprintf(stderr, "Command: %s, %lu\n", c->command, strlen(c->command));
+    fprintf(stderr, "Location: %s, %lu\n", c->location, strlen(c->location));
+    fprintf(stderr, "Version: %s, %lu\n", c->version, strlen(c->version));
+    for (int i = 0; i < c->nheaders; i++) {
+        fprintf(stderr, "Header: %s: %s\n", c->headers[i].name, c->headers[i].value);
+    }
+}
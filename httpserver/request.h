@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define BUFFER_SIZE 4096
+#define MAX_HEADERS 32 // header lines accepted per request
+#define MAX_RANGES  16 // byte ranges served from one request; more and the whole file is sent
+
+typedef struct {
+
+    char *name;
+    char *value;
+
+} Header;
+
+// Bytes first to last of a file, inclusive, as Content-Range writes them.
+typedef struct {
+
+    off_t first;
+    off_t last;
+
+} Range;
+
+// One request head and whatever followed it on the connection. The parsed fields point into
+// buf, where cmd_parse() NUL-terminates them in place, and stay valid until buf is reused for
+// the next request.
+typedef struct {
+
+    char buf[BUFFER_SIZE + 1];
+    uint16_t bufsize;
+    uint16_t scanned; // bytes of buf already searched for the end of the head
+    char *command;
+    char *location;
+    char *version;
+    Header headers[MAX_HEADERS];
+    int nheaders;
+    int head_len; // bytes of buf up to and including the blank line
+    long content_length; // -1 without a Content-Length header
+    int keep_alive; // the client did not send Connection: close
+
+} Command;
+
+// Looks for the blank line ending the head, scanning only bytes added since the last call.
+// Returns the length of the head, or 0 if it is not complete yet.
+int cmd_head_end(Command *c);
+
+// Parses the head found by cmd_head_end(), whose length must be in c->head_len. Returns 0, or
+// the response to reject the request with: 5 (malformed), 6 (method) or 7 (version).
+int cmd_parse(Command *c);
+
+// Returns the value of header name (any case), or NULL if the request does not have it.
+const char *cmd_header(Command *c, const char *name);
+
+// Reads the Range header against a file of size bytes into up to max ranges, clamped to the
+// file. Returns how many there are, 0 to send the whole file (no Range header, or one that is
+// malformed or asks for too many ranges) or -1 if none of the ranges is satisfiable.
+int cmd_ranges(Command *c, off_t size, Range *ranges, int max);
+
+// True if the entity-tag list value ("*" or comma-separated tags) matches etag. Weak comparison
+// ignores W/ prefixes, as If-None-Match does; strong comparison, for If-Match, never matches a
+// weak tag.
+int cmd_etag_match(const char *value, const char *etag, int weak);
+
+// Reads an HTTP-date such as "Sun, 06 Nov 1994 08:49:37 GMT" into *t. Returns 0, or -1 if value
+// is not one.
+int cmd_http_date(const char *value, time_t *t);
+
+void cmd_dump(Command *c);